@@ -0,0 +1,76 @@
+#ifndef WORKSPACES_CPP20_ALLOC_COUNTER_HPP
+#define WORKSPACES_CPP20_ALLOC_COUNTER_HPP
+
+#pragma once
+
+// Replaces the global allocation functions with counting versions. Include it
+// from exactly one translation unit of a benchmark executable.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include <malloc.h>
+
+namespace async_chain::bench {
+
+struct AllocCounters {
+  std::atomic<std::uint64_t> allocations{0};
+  std::atomic<std::int64_t> live_bytes{0};
+};
+
+inline auto allocCounters() -> AllocCounters& {
+  static AllocCounters counters;
+  return counters;
+}
+
+struct AllocSnapshot {
+  std::uint64_t allocations = 0;
+  std::int64_t live_bytes = 0;
+};
+
+inline auto allocSnapshot() -> AllocSnapshot {
+  auto& counters = allocCounters();
+  return AllocSnapshot{counters.allocations.load(std::memory_order_relaxed),
+                       counters.live_bytes.load(std::memory_order_relaxed)};
+}
+
+}  // namespace async_chain::bench
+
+inline auto countedAlloc(std::size_t size) -> void* {
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  auto& counters = async_chain::bench::allocCounters();
+  counters.allocations.fetch_add(1, std::memory_order_relaxed);
+  counters.live_bytes.fetch_add(
+      static_cast<std::int64_t>(malloc_usable_size(ptr)),
+      std::memory_order_relaxed);
+  return ptr;
+}
+
+inline void countedFree(void* ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  async_chain::bench::allocCounters().live_bytes.fetch_sub(
+      static_cast<std::int64_t>(malloc_usable_size(ptr)),
+      std::memory_order_relaxed);
+  std::free(ptr);
+}
+
+auto operator new(std::size_t size) -> void* { return countedAlloc(size); }
+auto operator new[](std::size_t size) -> void* { return countedAlloc(size); }
+void operator delete(void* ptr) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, std::size_t /*size*/) noexcept {
+  countedFree(ptr);
+}
+void operator delete[](void* ptr, std::size_t /*size*/) noexcept {
+  countedFree(ptr);
+}
+
+#endif
@@ -0,0 +1,264 @@
+// Compares an N-step AsyncChain with the same steps written as hand-nested
+// callbacks, as a std::promise/std::future chain and as a std::async chain.
+// Every variant calls the same step object; only the plumbing differs.
+//
+//   async_chain_bench_baselines [--iterations=1e5] [--repetitions=3]
+//                               [--threads=N] [--out=bench_baselines.md]
+//                               [--json=path]
+//
+// The markdown table is rewritten on every run. Latency and allocations are
+// measured on one thread; throughput runs independent chains on 1, 2, 4, ...
+// up to --threads threads. std::async spawns a thread per step, so it runs
+// 1/100 of the iterations.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/alloc_counter.hpp"
+#include "bench/bench_util.hpp"
+#include "include/async.hpp"
+
+using namespace async_chain;
+using namespace async_chain::bench;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+using StepResult = Result<int, int>;
+
+// The empty asm keeps the compiler from folding a whole inlined chain into a
+// constant, so every variant pays for each step it runs.
+struct AddOne {
+  template <typename Next>
+  void operator()(Next next, StepResult result) const {
+    int value = *result.value;
+    asm volatile("" : "+r"(value) : : "memory");
+    next(StepResult::Ok(value + 1));
+  }
+};
+
+AddOne add_one;
+
+template <std::size_t Remaining, typename Chain>
+void appendAndRun(Chain&& chain, int& sink) {
+  if constexpr (Remaining == 0) {
+    std::move(chain).finally([&sink](StepResult r) { sink = *r.value; });
+  } else {
+    appendAndRun<Remaining - 1>(std::move(chain).then(add_one), sink);
+  }
+}
+
+template <std::size_t Steps>
+void runChain(int& sink) {
+  appendAndRun<Steps>(initAsyncChain<int, int>(), sink);
+}
+
+// What a careful author writes by hand: one lambda per step, checked for
+// errors the way Holder does, no type erasure.
+template <std::size_t Remaining, typename Done>
+void nestedSteps(StepResult result, Done& done) {
+  if constexpr (Remaining == 0) {
+    done(std::move(result));
+  } else {
+    add_one(
+        [&done](StepResult next) {
+          if (next.is_err()) {
+            done(std::move(next));
+            return;
+          }
+          nestedSteps<Remaining - 1>(std::move(next), done);
+        },
+        std::move(result));
+  }
+}
+
+template <std::size_t Steps>
+void runNested(int& sink) {
+  auto done = [&sink](StepResult r) { sink = *r.value; };
+  nestedSteps<Steps>(StepResult::Ok(0), done);
+}
+
+template <std::size_t Steps>
+void runFutures(int& sink) {
+  std::promise<int> first;
+  auto value = first.get_future();
+  first.set_value(0);
+  for (std::size_t i = 0; i < Steps; ++i) {
+    std::promise<int> promise;
+    auto next = promise.get_future();
+    add_one([&promise](StepResult r) { promise.set_value(*r.value); },
+            StepResult::Ok(value.get()));
+    value = std::move(next);
+  }
+  sink = value.get();
+}
+
+template <std::size_t Steps>
+void runAsync(int& sink) {
+  auto value = std::async(std::launch::deferred, [] { return 0; });
+  for (std::size_t i = 0; i < Steps; ++i) {
+    value = std::async(std::launch::async, [prev = std::move(value)]() mutable {
+      int out = 0;
+      add_one([&out](StepResult r) { out = *r.value; },
+              StepResult::Ok(prev.get()));
+      return out;
+    });
+  }
+  sink = value.get();
+}
+
+using Runner = void (*)(int&);
+
+constexpr std::array<std::size_t, 3> kSteps{1, 4, 16};
+
+struct Variant {
+  const char* name;
+  std::array<Runner, 3> runners;
+  std::size_t iteration_divisor;
+};
+
+const std::array<Variant, 4> kVariants{{
+    {"async_chain", {&runChain<1>, &runChain<4>, &runChain<16>}, 1},
+    {"nested_callbacks", {&runNested<1>, &runNested<4>, &runNested<16>}, 1},
+    {"promise_future", {&runFutures<1>, &runFutures<4>, &runFutures<16>}, 1},
+    {"std_async", {&runAsync<1>, &runAsync<4>, &runAsync<16>}, 100},
+}};
+
+struct Single {
+  double ns_per_step = 0;
+  double allocs_per_step = 0;
+};
+
+auto measureSingle(Runner run, std::size_t steps, std::size_t iterations)
+    -> Single {
+  int sink = 0;
+  for (std::size_t i = 0; i < iterations / 10 + 1; ++i) {
+    run(sink);
+  }
+  const auto allocs_before = allocSnapshot().allocations;
+  const auto start = Clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    run(sink);
+  }
+  const auto elapsed = Clock::now() - start;
+  const auto total_steps = static_cast<double>(iterations * steps);
+  Single single;
+  single.ns_per_step =
+      static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+              .count()) /
+      total_steps;
+  single.allocs_per_step =
+      static_cast<double>(allocSnapshot().allocations - allocs_before) /
+      total_steps;
+  if (sink != static_cast<int>(steps)) {
+    std::fprintf(stderr, "unexpected chain result %d\n", sink);
+  }
+  return single;
+}
+
+// Chains completed per second with `threads` threads each running
+// `iterations` chains back to back.
+auto measureThroughput(Runner run, std::size_t threads, std::size_t iterations)
+    -> double {
+  std::vector<std::thread> workers;
+  const auto start = Clock::now();
+  for (std::size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([run, iterations] {
+      int sink = 0;
+      for (std::size_t i = 0; i < iterations; ++i) {
+        run(sink);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return static_cast<double>(threads * iterations) / seconds;
+}
+
+auto median(std::vector<double> values) -> double {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  const Flags flags(argc, argv);
+  const auto iterations =
+      static_cast<std::size_t>(flags.get("iterations", 1e5));
+  const auto repetitions = std::max<std::size_t>(
+      1, static_cast<std::size_t>(flags.get("repetitions", 3)));
+  const auto max_threads = static_cast<std::size_t>(
+      flags.get("threads", std::max(1U, std::thread::hardware_concurrency())));
+  const auto out_path = flags.get("out", std::string("bench_baselines.md"));
+
+  std::vector<std::size_t> thread_counts;
+  for (std::size_t t = 1; t < max_threads; t *= 2) {
+    thread_counts.push_back(t);
+  }
+  thread_counts.push_back(max_threads);
+
+  std::string table = "| variant | steps | ns/step | allocs/step |";
+  std::string rule = "|---|---:|---:|---:|";
+  for (auto t : thread_counts) {
+    table += " chains/s @" + std::to_string(t) + "T |";
+    rule += "---:|";
+  }
+  table += "\n" + rule + "\n";
+
+  BenchReport report("baselines");
+  for (const auto& variant : kVariants) {
+    const auto runs = std::max<std::size_t>(
+        10, iterations / variant.iteration_divisor);
+    for (std::size_t s = 0; s < kSteps.size(); ++s) {
+      const auto name =
+          std::string(variant.name) + "/" + std::to_string(kSteps[s]);
+      std::vector<double> ns;
+      std::vector<double> allocs;
+      for (std::size_t rep = 0; rep < repetitions; ++rep) {
+        const auto single = measureSingle(variant.runners[s], kSteps[s], runs);
+        ns.push_back(single.ns_per_step);
+        allocs.push_back(single.allocs_per_step);
+        report.add(name, "ns_per_step", single.ns_per_step);
+        report.add(name, "allocs_per_step", single.allocs_per_step);
+        report.add(name, "rss_bytes", static_cast<double>(rssBytes()));
+      }
+      char row[128];
+      std::snprintf(row, sizeof(row), "| %s | %zu | %.1f | %.2f |",
+                    variant.name, kSteps[s], median(ns), median(allocs));
+      table += row;
+      for (auto t : thread_counts) {
+        const double rate = measureThroughput(variant.runners[s], t, runs);
+        report.add(name, "chains_per_s@" + std::to_string(t), rate);
+        std::snprintf(row, sizeof(row), " %.0f |", rate);
+        table += row;
+      }
+      table += "\n";
+    }
+  }
+
+  std::printf("%s", table.c_str());
+  std::ofstream(out_path) << "Generated by async_chain_bench_baselines, "
+                          << iterations << " iterations, median of "
+                          << repetitions << " runs.\n\n"
+                          << table;
+  if (flags.has("json") && !report.write(flags.get("json", std::string()))) {
+    std::fprintf(stderr, "cannot write %s\n",
+                 flags.get("json", std::string()).c_str());
+    return 1;
+  }
+  return 0;
+}
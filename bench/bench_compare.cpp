@@ -0,0 +1,277 @@
+// Compares two BenchReport JSON files and fails on regressions.
+//
+//   async_chain_bench_compare baseline.json candidate.json
+//                             [--threshold=0.05] [--mad-k=3]
+//
+// For every benchmark in both files, each metric's repetitions are reduced to
+// a median and a median absolute deviation (MAD). ns_per_step,
+// allocs_per_step, rss_bytes and heap_bytes_per_chain are lower-is-better and
+// gate the exit code: a candidate regresses when its median exceeds the
+// baseline median by more than both --threshold (relative) and --mad-k scaled
+// MADs of the noisier side. Other metrics are printed for information. Exit
+// status is 0 when clean, 1 on any regression and 2 on bad input.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bench/bench_util.hpp"
+
+using namespace async_chain::bench;
+
+namespace {
+
+using Samples = std::map<std::string, std::vector<double>>;
+using Benchmarks = std::vector<std::pair<std::string, Samples>>;
+
+// Just enough JSON for BenchReport output: objects, arrays, strings without
+// escapes beyond \" and \\, and numbers.
+class Parser {
+ public:
+  explicit Parser(std::string text) : text_(std::move(text)) {}
+
+  auto benchmarks() -> std::optional<Benchmarks> {
+    Benchmarks out;
+    bool ok = object([&](const std::string& key) {
+      if (key != "benchmarks") {
+        return skip();
+      }
+      return array([&] {
+        std::string name;
+        Samples samples;
+        bool entry_ok = object([&](const std::string& field) {
+          if (field == "name") {
+            return string(name);
+          }
+          if (field != "metrics") {
+            return skip();
+          }
+          return object([&](const std::string& metric) {
+            auto& values = samples[metric];
+            return array([&] {
+              double value = 0;
+              bool number_ok = number(value);
+              values.push_back(value);
+              return number_ok;
+            });
+          });
+        });
+        out.emplace_back(std::move(name), std::move(samples));
+        return entry_ok;
+      });
+    });
+    if (!ok) {
+      return std::nullopt;
+    }
+    return out;
+  }
+
+ private:
+  std::string text_;
+  std::size_t pos_ = 0;
+
+  auto peek() -> char {
+    while (pos_ < text_.size() &&
+           std::isspace(static_cast<unsigned char>(text_[pos_])) != 0) {
+      ++pos_;
+    }
+    return pos_ < text_.size() ? text_[pos_] : '\0';
+  }
+
+  auto consume(char c) -> bool {
+    if (peek() != c) {
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  template <typename OnMember>
+  auto object(OnMember&& on_member) -> bool {
+    if (!consume('{')) {
+      return false;
+    }
+    if (consume('}')) {
+      return true;
+    }
+    do {
+      std::string key;
+      if (!string(key) || !consume(':') || !on_member(key)) {
+        return false;
+      }
+    } while (consume(','));
+    return consume('}');
+  }
+
+  template <typename OnElement>
+  auto array(OnElement&& on_element) -> bool {
+    if (!consume('[')) {
+      return false;
+    }
+    if (consume(']')) {
+      return true;
+    }
+    do {
+      if (!on_element()) {
+        return false;
+      }
+    } while (consume(','));
+    return consume(']');
+  }
+
+  auto string(std::string& out) -> bool {
+    if (!consume('"')) {
+      return false;
+    }
+    out.clear();
+    while (pos_ < text_.size() && text_[pos_] != '"') {
+      if (text_[pos_] == '\\' && pos_ + 1 < text_.size()) {
+        ++pos_;
+      }
+      out += text_[pos_++];
+    }
+    return consume('"');
+  }
+
+  auto number(double& out) -> bool {
+    peek();
+    const char* begin = text_.c_str() + pos_;
+    char* end = nullptr;
+    out = std::strtod(begin, &end);
+    pos_ += static_cast<std::size_t>(end - begin);
+    return end != begin;
+  }
+
+  auto skip() -> bool {
+    switch (peek()) {
+      case '{':
+        return object([&](const std::string&) { return skip(); });
+      case '[':
+        return array([&] { return skip(); });
+      case '"': {
+        std::string ignored;
+        return string(ignored);
+      }
+      default: {
+        for (const char* word : {"true", "false", "null"}) {
+          const std::string w = word;
+          if (text_.compare(pos_, w.size(), w) == 0) {
+            pos_ += w.size();
+            return true;
+          }
+        }
+        double ignored = 0;
+        return number(ignored);
+      }
+    }
+  }
+};
+
+auto load(const char* path) -> std::optional<Benchmarks> {
+  std::ifstream file(path);
+  if (!file) {
+    return std::nullopt;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  return Parser(text.str()).benchmarks();
+}
+
+auto median(std::vector<double> values) -> double {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  const auto mid = values.size() / 2;
+  return values.size() % 2 == 1 ? values[mid]
+                                : (values[mid - 1] + values[mid]) / 2;
+}
+
+// Scaled so it estimates the standard deviation of normally distributed
+// samples.
+auto mad(const std::vector<double>& values, double center) -> double {
+  std::vector<double> deviations;
+  deviations.reserve(values.size());
+  for (double v : values) {
+    deviations.push_back(std::fabs(v - center));
+  }
+  return 1.4826 * median(std::move(deviations));
+}
+
+auto gated(const std::string& metric) -> bool {
+  return metric == "ns_per_step" || metric == "allocs_per_step" ||
+         metric == "rss_bytes" || metric == "heap_bytes_per_chain";
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  const Flags flags(argc, argv);
+  const auto& paths = flags.positional();
+  const double threshold = flags.get("threshold", 0.05);
+  const double mad_k = flags.get("mad-k", 3);
+  if (paths.size() != 2) {
+    std::fprintf(stderr,
+                 "usage: async_chain_bench_compare baseline.json "
+                 "candidate.json [--threshold=0.05] [--mad-k=3]\n");
+    return 2;
+  }
+  const auto baseline = load(paths[0]);
+  const auto candidate = load(paths[1]);
+  if (!baseline || !candidate) {
+    std::fprintf(stderr, "cannot read %s\n", baseline ? paths[1] : paths[0]);
+    return 2;
+  }
+
+  std::size_t regressions = 0;
+  std::printf("| benchmark | metric | baseline | candidate | delta | noise | "
+              "verdict |\n");
+  std::printf("|---|---|---:|---:|---:|---:|---|\n");
+  for (const auto& [name, base_metrics] : *baseline) {
+    const auto cand = std::find_if(
+        candidate->begin(), candidate->end(),
+        [&name = name](const auto& b) { return b.first == name; });
+    if (cand == candidate->end()) {
+      std::printf("| %s | - | - | - | - | - | missing |\n", name.c_str());
+      continue;
+    }
+    for (const auto& [metric, base_samples] : base_metrics) {
+      const auto it = cand->second.find(metric);
+      if (it == cand->second.end() || base_samples.empty() ||
+          it->second.empty()) {
+        continue;
+      }
+      const double base = median(base_samples);
+      const double next = median(it->second);
+      const double noise =
+          mad_k * std::max(mad(base_samples, base), mad(it->second, next));
+      const double delta = next - base;
+      const char* verdict = "";
+      if (gated(metric)) {
+        const bool worse = delta > std::max(threshold * base, noise);
+        const bool better = -delta > std::max(threshold * base, noise);
+        verdict = worse ? "REGRESSION" : better ? "improved" : "ok";
+        regressions += worse ? 1 : 0;
+      }
+      char change[32] = "-";
+      if (base != 0) {
+        std::snprintf(change, sizeof(change), "%+.1f%%", 100 * delta / base);
+      }
+      std::printf("| %s | %s | %.4g | %.4g | %s | %.3g | %s |\n",
+                  name.c_str(), metric.c_str(), base, next, change, noise,
+                  verdict);
+    }
+  }
+  std::printf("\n%zu regression(s)\n", regressions);
+  return regressions == 0 ? 0 : 1;
+}
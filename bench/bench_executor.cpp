@@ -0,0 +1,76 @@
+// Executor submission throughput: one post() per task versus postBatch() with
+// a fixed batch size.
+//
+//   async_chain_bench_executor [tasks] [batch] [threads]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "include/executor.hpp"
+
+using namespace async_chain;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+auto run(std::size_t tasks, std::size_t batch, std::size_t threads) -> double {
+  Executor executor(threads);
+  std::atomic<std::size_t> remaining{tasks};
+  std::promise<void> done;
+  auto task = [&] {
+    if (--remaining == 0) {
+      done.set_value();
+    }
+  };
+
+  const auto start = Clock::now();
+  if (batch <= 1) {
+    for (std::size_t i = 0; i < tasks; ++i) {
+      executor.post(task);
+    }
+  } else {
+    std::vector<Executor::Task> pending;
+    pending.reserve(batch);
+    for (std::size_t i = 0; i < tasks; ++i) {
+      pending.emplace_back(task);
+      if (pending.size() == batch) {
+        executor.postBatch(pending);
+      }
+    }
+    executor.postBatch(pending);
+  }
+  done.get_future().wait();
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  const std::size_t tasks =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  const std::size_t batch =
+      argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+  const std::size_t threads =
+      argc > 3 ? std::strtoul(argv[3], nullptr, 10)
+               : std::max(1U, std::thread::hardware_concurrency());
+
+  const double single_s = run(tasks, 1, threads);
+  const double batch_s = run(tasks, batch, threads);
+
+  std::printf("%zu tasks, %zu worker threads\n\n", tasks, threads);
+  std::printf("| submission        | seconds | Mtasks/s |\n");
+  std::printf("|-------------------|--------:|---------:|\n");
+  std::printf("| post()            | %7.3f | %8.2f |\n", single_s,
+              static_cast<double>(tasks) / single_s / 1e6);
+  std::printf("| postBatch(%5zu)  | %7.3f | %8.2f |\n", batch, batch_s,
+              static_cast<double>(tasks) / batch_s / 1e6);
+  std::printf("\nspeedup: %.2fx\n", single_s / batch_s);
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Wakeup latency and worker CPU usage at several open-loop arrival rates, with
+// workers that park immediately versus the adaptive spin-then-park policy.
+//
+//   async_chain_bench_idle [threads] [seconds_per_point]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bench/bench_util.hpp"
+#include "include/executor.hpp"
+
+using namespace async_chain;
+using namespace async_chain::bench;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Point {
+  double p50_us = 0;
+  double p99_us = 0;
+  double worker_cpu = 0;  // cores busy in executor threads
+};
+
+auto measure(std::chrono::nanoseconds max_spin, std::size_t threads,
+             double rate, double seconds) -> Point {
+  std::vector<std::int64_t> latencies;
+  std::mutex latencies_mutex;
+  const auto count = static_cast<std::size_t>(rate * seconds);
+  latencies.reserve(count);
+  const auto gap = std::chrono::nanoseconds(
+      static_cast<std::int64_t>(1e9 / rate));
+
+  double wall = 0;
+  double cpu = 0;
+  {
+    ExecutorOptions options;
+    options.threads = threads;
+    options.max_spin = max_spin;
+    Executor executor(options);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    const double cpu_before = processCpuSeconds();
+    const double producer_before = threadCpuSeconds();
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto due = start + gap * i;
+      while (Clock::now() < due) {
+      }
+      executor.post([&, due] {
+        const auto late = Clock::now() - due;
+        std::lock_guard<std::mutex> lock(latencies_mutex);
+        latencies.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(late)
+                .count());
+      });
+    }
+    const double producer = threadCpuSeconds() - producer_before;
+    while (true) {
+      std::lock_guard<std::mutex> lock(latencies_mutex);
+      if (latencies.size() == count) {
+        break;
+      }
+    }
+    wall = std::chrono::duration<double>(Clock::now() - start).count();
+    cpu = processCpuSeconds() - cpu_before - producer;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  Point out;
+  out.p50_us = static_cast<double>(latencies[count / 2]) / 1e3;
+  out.p99_us = static_cast<double>(latencies[count * 99 / 100]) / 1e3;
+  out.worker_cpu = std::max(cpu, 0.0) / wall;
+  return out;
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  const std::size_t threads =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const double seconds = argc > 2 ? std::strtod(argv[2], nullptr) : 0.5;
+
+  std::printf("%zu worker threads, %.1f s per point; latency is post to task "
+              "start, CPU is executor cores busy (producer excluded)\n\n",
+              threads, seconds);
+  std::printf("| tasks/s | policy     |   p50 us |   p99 us | worker CPU |\n");
+  std::printf("|--------:|------------|---------:|---------:|-----------:|\n");
+  for (double rate : {1e3, 1e4, 5e4, 2e5}) {
+    for (auto spin : {std::chrono::nanoseconds(0),
+                      std::chrono::nanoseconds(std::chrono::microseconds(50))}) {
+      const auto p = measure(spin, threads, rate, seconds);
+      std::printf("| %7.0f | %-10s | %8.1f | %8.1f | %10.2f |\n", rate,
+                  spin.count() == 0 ? "park" : "spin+park", p.p50_us, p.p99_us,
+                  p.worker_cpu);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,179 @@
+// Memory held by idle in-flight chains: every chain's first step parks its
+// continuation, as a step waiting on I/O would, and the process is measured
+// with all of them pending.
+//
+//   async_chain_bench_memory [--chains=1e5] [--repetitions=3] [--json=path]
+//
+// For 1-, 4- and 16-step chains it prints the compile-time frame size, heap
+// bytes and allocations per parked chain, and the RSS growth scaled to 100k
+// chains. --json writes heap_bytes_per_chain and rss_bytes (per 100k chains)
+// for async_chain_bench_compare, so a holder layout change that grows chains
+// shows up as a regression.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <malloc.h>
+
+#include "bench/alloc_counter.hpp"
+#include "bench/bench_util.hpp"
+#include "include/async.hpp"
+
+using namespace async_chain;
+using namespace async_chain::bench;
+
+namespace {
+
+using StepResult = Result<int, int>;
+using Parked = std::vector<std::function<void(StepResult)>>;
+
+struct Park {
+  Parked* parked = nullptr;
+
+  template <typename Next>
+  void operator()(Next next, StepResult /*result*/) const {
+    parked->emplace_back(std::move(next));
+  }
+};
+
+struct AddOne {
+  template <typename Next>
+  void operator()(Next next, StepResult result) const {
+    next(StepResult::Ok(*result.value + 1));
+  }
+};
+
+Park park;
+AddOne add_one;
+
+struct Sink {
+  int* out;
+  void operator()(StepResult result) const { *out += *result.value; }
+};
+
+template <std::size_t Remaining, typename Chain>
+void appendAndStart(Chain&& chain, int& sink) {
+  if constexpr (Remaining == 0) {
+    std::move(chain).finally(Sink{&sink});
+  } else {
+    appendAndStart<Remaining - 1>(std::move(chain).then(add_one), sink);
+  }
+}
+
+template <std::size_t Steps>
+void startParked(int& sink) {
+  appendAndStart<Steps - 1>(initAsyncChain<int, int>().then(park), sink);
+}
+
+// The plan startParked<Steps> builds, named without building it.
+template <typename Indexes>
+struct ParkedPlan;
+
+template <std::size_t... I>
+struct ParkedPlan<std::index_sequence<I...>> {
+  template <std::size_t>
+  using AddOneHolder = Holder<AddOne>;
+  using type = AsyncChain<int, int, Holder<Park>, AddOneHolder<I>...>;
+};
+
+template <std::size_t Steps>
+constexpr auto frameBytes() -> std::size_t {
+  using Plan = typename ParkedPlan<std::make_index_sequence<Steps - 1>>::type;
+  return Plan::template frameBytes<Sink>();
+}
+
+struct Sample {
+  double heap_bytes = 0;
+  double allocs = 0;
+  double rss_per_100k = 0;
+};
+
+auto measure(void (*start)(int&), std::size_t chains) -> Sample {
+  // Touched up front so the parking slots are not counted as chain memory.
+  Parked parked(chains);
+  parked.clear();
+  park.parked = &parked;
+  int sink = 0;
+  malloc_trim(0);
+  const auto rss_before = rssBytes();
+  const auto heap_before = allocSnapshot();
+  for (std::size_t i = 0; i < chains; ++i) {
+    start(sink);
+  }
+  const auto heap_after = allocSnapshot();
+  const auto rss_after = rssBytes();
+
+  for (auto& next : parked) {
+    next(StepResult::Ok(0));
+  }
+  parked.clear();
+
+  const auto n = static_cast<double>(chains);
+  Sample out;
+  out.heap_bytes =
+      static_cast<double>(heap_after.live_bytes - heap_before.live_bytes) / n;
+  out.allocs =
+      static_cast<double>(heap_after.allocations - heap_before.allocations) /
+      n;
+  out.rss_per_100k = static_cast<double>(rss_after - rss_before) * 1e5 / n;
+  return out;
+}
+
+constexpr std::array<std::size_t, 3> kSteps = {1, 4, 16};
+constexpr std::array<void (*)(int&), 3> kStart = {
+    startParked<1>, startParked<4>, startParked<16>};
+constexpr std::array<std::size_t, 3> kFrameBytes = {
+    frameBytes<1>(), frameBytes<4>(), frameBytes<16>()};
+
+auto median(std::vector<double> values) -> double {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  const Flags flags(argc, argv);
+  const auto chains = std::max<std::size_t>(
+      1, static_cast<std::size_t>(flags.get("chains", 1e5)));
+  const auto repetitions = std::max<std::size_t>(
+      1, static_cast<std::size_t>(flags.get("repetitions", 3)));
+
+  BenchReport report("memory");
+  std::printf("%zu parked chains, median of %zu runs\n\n", chains,
+              repetitions);
+  std::printf("| steps | frame bytes | heap bytes/chain | allocs/chain | "
+              "RSS per 100k chains |\n");
+  std::printf("|---:|---:|---:|---:|---:|\n");
+  for (std::size_t s = 0; s < kSteps.size(); ++s) {
+    const auto name = "parked/" + std::to_string(kSteps[s]);
+    std::vector<double> heap;
+    std::vector<double> allocs;
+    std::vector<double> rss;
+    for (std::size_t rep = 0; rep < repetitions; ++rep) {
+      const auto sample = measure(kStart[s], chains);
+      heap.push_back(sample.heap_bytes);
+      allocs.push_back(sample.allocs);
+      rss.push_back(sample.rss_per_100k);
+      report.add(name, "heap_bytes_per_chain", sample.heap_bytes);
+      report.add(name, "allocs_per_chain", sample.allocs);
+      report.add(name, "rss_bytes", sample.rss_per_100k);
+    }
+    std::printf("| %zu | %zu | %.1f | %.2f | %.1f MiB |\n", kSteps[s],
+                kFrameBytes[s], median(heap), median(allocs),
+                median(rss) / (1024.0 * 1024.0));
+  }
+  if (flags.has("json") && !report.write(flags.get("json", std::string()))) {
+    std::fprintf(stderr, "cannot write %s\n",
+                 flags.get("json", std::string()).c_str());
+    return 1;
+  }
+  return 0;
+}
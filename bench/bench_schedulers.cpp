@@ -0,0 +1,219 @@
+// Timer data-structure harness. Part one measures raw queue costs at growing
+// numbers of pending timers; part two runs one delayed-retry workload through
+// every SchedulerFunction implementation and reports expiry jitter.
+//
+//   async_chain_bench_schedulers [--max=1e6] [--chains=2000] [--slack=0.05]
+//
+// Memory per timer is the growth of live heap bytes divided by the number of
+// pending timers, so it includes the std::function and container overhead.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/alloc_counter.hpp"
+#include "bench/bench_util.hpp"
+#include "include/async.hpp"
+#include "include/timer.hpp"
+
+using namespace async_chain;
+using namespace async_chain::bench;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr std::size_t kMaxDelayMs = 60000;
+constexpr std::size_t kRetryDelayMs = 20;
+
+auto nsPer(Clock::duration d, std::size_t count) -> double {
+  return static_cast<double>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) /
+         static_cast<double>(std::max<std::size_t>(count, 1));
+}
+
+struct QueueCosts {
+  double insert_ns = 0;
+  double cancel_ns = 0;
+  double expire_ns = 0;
+  double bytes_per_timer = 0;
+};
+
+template <typename Queue>
+auto measureQueue(Queue& queue, std::size_t pending) -> QueueCosts {
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<std::size_t> delay(1, kMaxDelayMs);
+  std::vector<std::size_t> delays(pending);
+  for (auto& d : delays) {
+    d = delay(rng);
+  }
+  std::vector<typename Queue::Handle> handles;
+  handles.reserve(pending);
+  const auto now = Clock::now();
+  QueueCosts costs;
+
+  const auto bytes_before = allocSnapshot().live_bytes;
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < pending; ++i) {
+    handles.push_back(queue.insert([] {}, delays[i], now));
+  }
+  costs.insert_ns = nsPer(Clock::now() - start, pending);
+  costs.bytes_per_timer =
+      static_cast<double>(allocSnapshot().live_bytes - bytes_before) /
+      static_cast<double>(pending);
+
+  std::shuffle(handles.begin(), handles.end(), rng);
+  const auto cancels = std::max<std::size_t>(pending / 10, 1);
+  start = Clock::now();
+  for (std::size_t i = 0; i < cancels; ++i) {
+    queue.cancel(handles[i]);
+  }
+  costs.cancel_ns = nsPer(Clock::now() - start, cancels);
+
+  std::vector<typename Queue::Task> due;
+  due.reserve(queue.size());
+  start = Clock::now();
+  queue.expire(now + std::chrono::milliseconds(kMaxDelayMs + 1), due);
+  costs.expire_ns = nsPer(Clock::now() - start, due.size());
+  return costs;
+}
+
+template <typename Queue, typename... Args>
+void printQueueRow(const char* name, std::size_t pending, Args... args) {
+  Queue queue(args...);
+  const auto c = measureQueue(queue, pending);
+  std::printf("| %-18s | %9zu | %9.1f | %9.1f | %9.1f | %9.1f |\n", name,
+              pending, c.insert_ns, c.cancel_ns, c.expire_ns,
+              c.bytes_per_timer);
+}
+
+struct Jitter {
+  LatencyHistogram late;
+  std::atomic<std::uint64_t> early{0};
+};
+
+// Wraps a scheduler so every task records how far from its requested
+// deadline it actually ran.
+auto measured(SchedulerFunction inner, Jitter& jitter) -> SchedulerFunction {
+  return [inner = std::move(inner), &jitter](std::function<void()> task,
+                                             std::size_t delay_ms) {
+    const auto due = Clock::now() + std::chrono::milliseconds(delay_ms);
+    inner(
+        [task = std::move(task), due, &jitter] {
+          const auto now = Clock::now();
+          if (now < due) {
+            jitter.early.fetch_add(1, std::memory_order_relaxed);
+          } else {
+            jitter.late.record(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - due)
+                    .count()));
+          }
+          task();
+        },
+        delay_ms);
+  };
+}
+
+// Starts `chains` chains whose one step fails twice before succeeding, with
+// starts spread over 200 ms, and waits for all of them.
+void runRetryWorkload(std::size_t chains) {
+  using MyResult = Result<int, std::string>;
+  auto flaky = [](auto next, std::size_t attempt) {
+    next(attempt < 2 ? MyResult::Err("retry") : MyResult::Ok(0));
+  };
+  std::atomic<std::size_t> remaining{chains};
+  std::promise<void> done;
+  const auto gap = std::chrono::microseconds(200000 / chains);
+  for (std::size_t i = 0; i < chains; ++i) {
+    const auto started = Clock::now();
+    initAsyncChain<int, std::string>()
+        .thenWithRetryDelayed<2, kRetryDelayMs>(flaky)
+        .finally([&](MyResult) {
+          if (--remaining == 0) {
+            done.set_value();
+          }
+        });
+    std::this_thread::sleep_until(started + gap);
+  }
+  done.get_future().wait();
+}
+
+void printJitterRow(const char* name, Jitter& jitter, const TimerStats* stats) {
+  const auto us = [&](double q) {
+    return static_cast<double>(jitter.late.quantile(q)) / 1e3;
+  };
+  std::printf("| %-18s | %8llu | %8.1f | %8.1f | %8.1f | %8s |\n", name,
+              static_cast<unsigned long long>(jitter.early.load()), us(0.5),
+              us(0.99), us(1.0),
+              stats != nullptr ? std::to_string(stats->wakeups).c_str() : "-");
+}
+
+template <typename Queue, typename... Args>
+void jitterRow(const char* name, std::size_t chains, Args... args) {
+  Jitter jitter;
+  TimerStats stats;
+  {
+    BasicTimerScheduler<Queue> timer(args...);
+    setScheduler(measured(timer.scheduler(), jitter));
+    runRetryWorkload(chains);
+    stats = timer.stats();
+    setScheduler(nullptr);
+  }
+  printJitterRow(name, jitter, &stats);
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  const Flags flags(argc, argv);
+  const auto max_pending = static_cast<std::size_t>(flags.get("max", 1e6));
+  const auto chains = static_cast<std::size_t>(flags.get("chains", 2000));
+  const double slack = flags.get("slack", 0.05);
+
+  std::printf("Queue costs, delays uniform in [1, %zu] ms, %.0f%% slack for "
+              "coalescing variants\n\n",
+              kMaxDelayMs, slack * 100);
+  std::printf("| queue              |   pending | insert ns | cancel ns | "
+              "expire ns | B / timer |\n");
+  std::printf("|--------------------|----------:|----------:|----------:|"
+              "----------:|----------:|\n");
+  for (std::size_t pending = 1000; pending <= max_pending; pending *= 10) {
+    printQueueRow<HeapTimerQueue>("binary heap", pending);
+    printQueueRow<WheelTimerQueue>("hierarchical wheel", pending);
+    printQueueRow<WheelTimerQueue>("coalescing wheel", pending, slack);
+    printQueueRow<CoalescingTimerQueue>("coalescing map", pending, slack);
+  }
+  std::printf("| %-18s | %9s | %9s | %9s | %9s | %9s |\n", "inline (tests)",
+              "-", "0", "-", "-", "0");
+
+  std::printf("\nExpiry jitter, %zu chains x thenWithRetryDelayed<2, %zu>\n\n",
+              chains, kRetryDelayMs);
+  std::printf("| scheduler          |    early | p50 late | p99 late | "
+              "max late |  wakeups |\n");
+  std::printf("|                    |          |       us |       us | "
+              "      us |          |\n");
+  std::printf("|--------------------|---------:|---------:|---------:|"
+              "---------:|---------:|\n");
+  jitterRow<HeapTimerQueue>("binary heap", chains);
+  jitterRow<WheelTimerQueue>("hierarchical wheel", chains);
+  jitterRow<WheelTimerQueue>("coalescing wheel", chains, slack);
+  jitterRow<CoalescingTimerQueue>("coalescing map", chains, slack);
+  {
+    Jitter jitter;
+    setScheduler(measured(
+        [](const std::function<void()>& task, std::size_t) { task(); },
+        jitter));
+    runRetryWorkload(chains);
+    setScheduler(nullptr);
+    printJitterRow("inline (tests)", jitter, nullptr);
+  }
+  return 0;
+}
@@ -0,0 +1,212 @@
+#ifndef WORKSPACES_CPP20_BENCH_UTIL_HPP
+#define WORKSPACES_CPP20_BENCH_UTIL_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace async_chain::bench {
+
+// Command line of the form `--name=value` or `--name value`; bare `--name`
+// is a boolean switch. Other arguments are positional.
+class Flags {
+ public:
+  Flags(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg.rfind("--", 0) != 0) {
+        positional_.push_back(argv[i]);
+        continue;
+      }
+      arg = arg.substr(2);
+      const auto eq = arg.find('=');
+      if (eq != std::string::npos) {
+        values_[arg.substr(0, eq)] = arg.substr(eq + 1);
+      } else if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0) {
+        values_[arg] = argv[++i];
+      } else {
+        values_[arg] = "1";
+      }
+    }
+  }
+
+  [[nodiscard]] auto has(const std::string& name) const -> bool {
+    return values_.count(name) != 0;
+  }
+
+  [[nodiscard]] auto get(const std::string& name, double fallback) const
+      -> double {
+    auto it = values_.find(name);
+    return it == values_.end() ? fallback : std::strtod(it->second.c_str(),
+                                                        nullptr);
+  }
+
+  [[nodiscard]] auto get(const std::string& name,
+                         const std::string& fallback) const -> std::string {
+    auto it = values_.find(name);
+    return it == values_.end() ? fallback : it->second;
+  }
+
+  [[nodiscard]] auto positional() const -> const std::vector<const char*>& {
+    return positional_;
+  }
+
+ private:
+  std::map<std::string, std::string> values_;
+  std::vector<const char*> positional_;
+};
+
+// Lock-free log-linear histogram of nanosecond values: 32 linear sub-buckets
+// per power of two, i.e. about 3% relative precision.
+class LatencyHistogram {
+ public:
+  void record(std::uint64_t ns) {
+    buckets_[index(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] auto count() const -> std::uint64_t {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  // Upper bound of the bucket holding the q-quantile, q in [0, 1].
+  [[nodiscard]] auto quantile(double q) const -> std::uint64_t {
+    const auto total = count();
+    if (total == 0) {
+      return 0;
+    }
+    auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total));
+    rank = rank >= total ? total - 1 : rank;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen > rank) {
+        return upperBound(i);
+      }
+    }
+    return upperBound(kBuckets - 1);
+  }
+
+ private:
+  static constexpr std::size_t kSubBits = 5;
+  static constexpr std::size_t kSub = std::size_t{1} << kSubBits;
+  static constexpr std::size_t kBuckets = (64 - kSubBits + 1) * kSub;
+
+  std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+  std::atomic<std::uint64_t> count_{0};
+
+  static auto index(std::uint64_t ns) -> std::size_t {
+    if (ns < kSub) {
+      return static_cast<std::size_t>(ns);
+    }
+    const auto msb = static_cast<std::size_t>(63 - __builtin_clzll(ns));
+    const auto shift = msb - kSubBits;
+    const auto sub = static_cast<std::size_t>(ns >> shift) - kSub;
+    return (shift + 1) * kSub + sub;
+  }
+
+  static auto upperBound(std::size_t index) -> std::uint64_t {
+    if (index < kSub) {
+      return index;
+    }
+    const auto shift = index / kSub - 1;
+    const auto sub = index % kSub;
+    return ((kSub + sub + 1) << shift) - 1;
+  }
+};
+
+inline auto processCpuSeconds() -> double {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) /
+             1e6;
+}
+
+inline auto threadCpuSeconds() -> double {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+// Reads a "<field>: <n> kB" line from /proc/self/status; 0 when unavailable.
+inline auto procStatusBytes(const std::string& field) -> std::uint64_t {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind(field + ":", 0) == 0) {
+      return std::strtoull(line.c_str() + field.size() + 1, nullptr, 10) *
+             1024;
+    }
+  }
+  return 0;
+}
+
+inline auto rssBytes() -> std::uint64_t { return procStatusBytes("VmRSS"); }
+inline auto peakRssBytes() -> std::uint64_t { return procStatusBytes("VmHWM"); }
+
+// Machine-readable results: every benchmark keeps one sample per repetition
+// for each metric, so a later comparison can judge noise itself.
+//
+//   {"suite": "...", "benchmarks": [
+//     {"name": "...", "metrics": {"ns_per_step": [..], ...}}, ...]}
+class BenchReport {
+ public:
+  explicit BenchReport(std::string suite) : suite_(std::move(suite)) {}
+
+  void add(const std::string& name, const std::string& metric, double value) {
+    auto it = std::find_if(benchmarks_.begin(), benchmarks_.end(),
+                           [&](const auto& b) { return b.first == name; });
+    if (it == benchmarks_.end()) {
+      benchmarks_.emplace_back(name, Metrics{});
+      it = std::prev(benchmarks_.end());
+    }
+    it->second[metric].push_back(value);
+  }
+
+  [[nodiscard]] auto write(const std::string& path) const -> bool {
+    std::ofstream out(path);
+    out.precision(12);
+    out << "{\"suite\": \"" << suite_ << "\", \"benchmarks\": [";
+    for (std::size_t i = 0; i < benchmarks_.size(); ++i) {
+      out << (i == 0 ? "\n" : ",\n") << "  {\"name\": \""
+          << benchmarks_[i].first << "\", \"metrics\": {";
+      bool first = true;
+      for (const auto& [metric, samples] : benchmarks_[i].second) {
+        out << (first ? "" : ", ") << "\"" << metric << "\": [";
+        for (std::size_t s = 0; s < samples.size(); ++s) {
+          out << (s == 0 ? "" : ", ") << samples[s];
+        }
+        out << "]";
+        first = false;
+      }
+      out << "}}";
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+  }
+
+ private:
+  using Metrics = std::map<std::string, std::vector<double>>;
+
+  std::string suite_;
+  std::vector<std::pair<std::string, Metrics>> benchmarks_;
+};
+
+}  // namespace async_chain::bench
+
+#endif
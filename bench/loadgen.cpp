@@ -0,0 +1,313 @@
+// Load generator: runs configurable chain shapes on an Executor, either
+// open-loop at a target start rate or closed-loop at a fixed concurrency, and
+// reports throughput, latency percentiles, CPU time and RSS.
+//
+//   async_chain_loadgen [--rate=N | --concurrency=N] [--duration=s]
+//                       [--length=1|2|4|8|16|32] [--depth=N]
+//                       [--retry-rate=p] [--error-rate=p] [--step-work-us=N]
+//                       [--step-wait-ms=N] [--threads=N] [--stats=path]
+//
+// Open-loop latency is measured from each chain's intended start time, so a
+// stalled system is charged for the starts it delayed (coordinated-omission
+// correction). Every step is a thenWithRetryDelayed<2, 1> step failing each
+// attempt with probability --retry-rate, and nesting runs the first step of
+// each level as a chain of the same length. --error-rate is the probability
+// that a top-level chain fails terminally, in a plain step after the retried
+// ones, so the reported error rate is about
+//
+//   error_rate + (1 - error_rate) * (1 - (1 - retry_rate^3)^steps)
+//
+// with steps the total across levels. --stats
+// publishes live counters, executor queue depth and pending timers to a
+// shared-memory file for async_chain_stats.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench/bench_util.hpp"
+#include "include/async.hpp"
+#include "include/executor.hpp"
+#include "include/stats.hpp"
+#include "include/timer.hpp"
+
+using namespace async_chain;
+using namespace async_chain::bench;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr std::size_t kRetries = 2;
+constexpr std::size_t kRetryDelayMs = 1;
+
+using LoadResult = Result<int, int>;
+using Final = std::function<void(LoadResult)>;
+
+struct Shape {
+  std::size_t length = 4;
+  std::size_t depth = 1;
+  double retry_rate = 0;
+  // Per top-level chain, not per attempt.
+  double error_rate = 0;
+  std::chrono::nanoseconds step_work{0};
+  std::size_t step_wait_ms = 0;
+};
+
+auto uniform() -> double {
+  thread_local std::uint64_t state =
+      0x9E3779B97F4A7C15ULL ^
+      std::hash<std::thread::id>{}(std::this_thread::get_id());
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return static_cast<double>(state >> 11) * 0x1.0p-53;
+}
+
+struct Level;
+void launch(Level& level, Final final);
+
+// One simulated step. Burns CPU, optionally completes after a timer wait and
+// fails with the retry probability; a nesting step instead runs the next
+// level's chain and forwards its result.
+struct LoadStep {
+  const Shape* shape = nullptr;
+  Level* nested = nullptr;
+
+  template <typename Next>
+  void operator()(Next next, std::size_t /*attempt*/) {
+    if (nested != nullptr) {
+      launch(*nested, [next](LoadResult result) mutable { next(result); });
+      return;
+    }
+    const auto until = Clock::now() + shape->step_work;
+    while (Clock::now() < until) {
+    }
+    auto result = uniform() < shape->retry_rate ? LoadResult::Err(2)
+                                                : LoadResult::Ok(0);
+    if (shape->step_wait_ms == 0) {
+      next(result);
+    } else {
+      global_scheduler([next, result]() mutable { next(result); },
+                       shape->step_wait_ms);
+    }
+  }
+};
+
+// Fails a chain that got this far with probability `rate`. It is not
+// retried, so the failure is terminal.
+struct FailStep {
+  double rate = 0;
+
+  template <typename Next>
+  void operator()(Next next, LoadResult result) const {
+    next(uniform() < rate ? LoadResult::Err(1) : result);
+  }
+};
+
+struct Level {
+  LoadStep first;
+  LoadStep rest;
+  FailStep fail;
+};
+
+template <std::size_t Remaining, typename Chain>
+void appendAndRun(Chain&& chain, Level& level, Final& final) {
+  if constexpr (Remaining == 0) {
+    std::move(chain).then(level.fail).finally(std::move(final));
+  } else {
+    appendAndRun<Remaining - 1>(
+        std::move(chain).template thenWithRetryDelayed<kRetries, kRetryDelayMs>(
+            level.rest),
+        level, final);
+  }
+}
+
+template <std::size_t Length>
+void launchFixed(Level& level, Final final) {
+  appendAndRun<Length - 1>(
+      initAsyncChain<int, int>()
+          .thenWithRetryDelayed<kRetries, kRetryDelayMs>(level.first),
+      level, final);
+}
+
+using Launcher = void (*)(Level&, Final);
+
+// Chain plans are compile-time types, so only these lengths are built.
+constexpr std::array<std::size_t, 6> kLengths{1, 2, 4, 8, 16, 32};
+constexpr std::array<Launcher, 6> kLaunchers{
+    &launchFixed<1>, &launchFixed<2>,  &launchFixed<4>,
+    &launchFixed<8>, &launchFixed<16>, &launchFixed<32>};
+
+std::size_t g_launcher = 0;
+
+void launch(Level& level, Final final) {
+  kLaunchers[g_launcher](level, std::move(final));
+}
+
+struct Totals {
+  LatencyHistogram latency;
+  std::atomic<std::uint64_t> started{0};
+  std::atomic<std::uint64_t> completed{0};
+  std::atomic<std::uint64_t> errors{0};
+};
+
+void record(Totals& totals, Clock::time_point since, const LoadResult& r) {
+  totals.latency.record(static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           since)
+          .count()));
+  if (r.is_err()) {
+    totals.errors.fetch_add(1, std::memory_order_relaxed);
+  }
+  totals.completed.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  const Flags flags(argc, argv);
+  Shape shape;
+  shape.length = static_cast<std::size_t>(flags.get("length", 4));
+  shape.depth = static_cast<std::size_t>(flags.get("depth", 1));
+  shape.retry_rate = flags.get("retry-rate", 0);
+  shape.error_rate = flags.get("error-rate", 0);
+  shape.step_work = std::chrono::nanoseconds(
+      static_cast<std::int64_t>(flags.get("step-work-us", 0) * 1000));
+  shape.step_wait_ms = static_cast<std::size_t>(flags.get("step-wait-ms", 0));
+  const double rate = flags.get("rate", 0);
+  const auto concurrency =
+      static_cast<std::size_t>(flags.get("concurrency", rate > 0 ? 0 : 64));
+  const double duration_s = flags.get("duration", 5);
+  const auto threads = static_cast<std::size_t>(
+      flags.get("threads", std::max(1U, std::thread::hardware_concurrency())));
+
+  const auto length_it =
+      std::find(kLengths.begin(), kLengths.end(), shape.length);
+  if (length_it == kLengths.end() || shape.depth < 1) {
+    std::fprintf(stderr,
+                 "--length must be one of 1, 2, 4, 8, 16, 32 and --depth "
+                 ">= 1\n");
+    return 2;
+  }
+  g_launcher = static_cast<std::size_t>(length_it - kLengths.begin());
+
+  std::vector<Level> levels(shape.depth);
+  for (std::size_t d = 0; d < shape.depth; ++d) {
+    levels[d].rest.shape = &shape;
+    levels[d].first.shape = &shape;
+    levels[d].first.nested = d + 1 < shape.depth ? &levels[d + 1] : nullptr;
+  }
+  levels[0].fail.rate = shape.error_rate;
+
+  Totals totals;
+  const double cpu_before = processCpuSeconds();
+  const auto start = Clock::now();
+  const auto stop_at =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(duration_s));
+  double elapsed_s = 0;
+  {
+    Executor executor(threads);
+    TimerScheduler timer;
+    timer.dispatchTo(executor);
+    setScheduler(timer.scheduler());
+    const auto queued = addStatsGauge("executor_queued", [&executor] {
+      std::uint64_t total = 0;
+      for (const auto& tenant : executor.allStats()) {
+        total += tenant.queued;
+      }
+      return total;
+    });
+    const auto pending = addStatsGauge(
+        "timers_pending", [&timer] { return timer.pending(); });
+    const auto pending_bytes = addStatsGauge(
+        "timers_pending_bytes", [&timer] { return timer.pendingBytes(); });
+    std::optional<StatsPublisher> publisher;
+    if (flags.has("stats")) {
+      publisher.emplace(flags.get("stats", std::string()));
+    }
+
+    if (rate > 0) {
+      const auto gap = std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1.0 / rate));
+      for (std::uint64_t i = 0;; ++i) {
+        const auto intended = start + gap * i;
+        if (intended >= stop_at) {
+          break;
+        }
+        std::this_thread::sleep_until(intended);
+        totals.started.fetch_add(1, std::memory_order_relaxed);
+        executor.post([&, intended] {
+          launch(levels[0],
+                 [&, intended](LoadResult r) { record(totals, intended, r); });
+        });
+      }
+    } else {
+      std::function<void()> start_one = [&] {
+        if (Clock::now() >= stop_at) {
+          return;
+        }
+        totals.started.fetch_add(1, std::memory_order_relaxed);
+        const auto started = Clock::now();
+        launch(levels[0], [&, started](LoadResult r) {
+          record(totals, started, r);
+          executor.post(start_one);
+        });
+      };
+      for (std::size_t i = 0; i < concurrency; ++i) {
+        executor.post(start_one);
+      }
+      std::this_thread::sleep_until(stop_at);
+    }
+    while (totals.completed.load() < totals.started.load()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+    publisher.reset();
+    removeStatsGauge(pending);
+    removeStatsGauge(pending_bytes);
+    removeStatsGauge(queued);
+    setScheduler(nullptr);
+  }
+  const double cpu_s = processCpuSeconds() - cpu_before;
+
+  const auto completed = totals.completed.load();
+  const auto ms = [&](double q) {
+    return static_cast<double>(totals.latency.quantile(q)) / 1e6;
+  };
+  if (rate > 0) {
+    std::printf("mode            open-loop, target %.0f chains/s\n", rate);
+  } else {
+    std::printf("mode            closed-loop, concurrency %zu\n", concurrency);
+  }
+  std::printf("shape           length %zu, depth %zu, retry %.3f, error %.3f, "
+              "work %lld us, wait %zu ms\n",
+              shape.length, shape.depth, shape.retry_rate, shape.error_rate,
+              static_cast<long long>(shape.step_work.count() / 1000),
+              shape.step_wait_ms);
+  std::printf("threads         %zu\n", threads);
+  std::printf("chains          %llu completed, %llu errors\n",
+              static_cast<unsigned long long>(completed),
+              static_cast<unsigned long long>(totals.errors.load()));
+  std::printf("throughput      %.1f chains/s\n",
+              static_cast<double>(completed) / elapsed_s);
+  std::printf("latency ms      p50 %.3f  p99 %.3f  p999 %.3f  max %.3f\n",
+              ms(0.5), ms(0.99), ms(0.999), ms(1.0));
+  std::printf("cpu             %.2f s (%.2f cores)\n", cpu_s,
+              cpu_s / elapsed_s);
+  std::printf("rss             %.1f MiB (peak %.1f MiB)\n",
+              static_cast<double>(rssBytes()) / (1 << 20),
+              static_cast<double>(peakRssBytes()) / (1 << 20));
+  return 0;
+}
@@ -3,13 +3,22 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 
+#include "stats.hpp"
+#include "step_timing.hpp"
+#include "trace.hpp"
+
 namespace async_chain {
 
 using SchedulerFunction =
@@ -27,26 +36,43 @@ struct Result {
   std::optional<E> error;
   std::optional<T> value;
 
-  static auto Ok(T val) -> Result {
+  static constexpr auto Ok(T val) -> Result {
     return Result{std::nullopt, std::move(val)};
   }
 
-  static auto Err(E err) -> Result {
+  static constexpr auto Err(E err) -> Result {
     return Result{std::move(err), std::nullopt};
   }
 
-  [[nodiscard]] auto is_ok() const -> bool { return value.has_value(); }
-  [[nodiscard]] auto is_err() const -> bool { return error.has_value(); }
+  [[nodiscard]] constexpr auto is_ok() const -> bool {
+    return value.has_value();
+  }
+  [[nodiscard]] constexpr auto is_err() const -> bool {
+    return error.has_value();
+  }
 };
 
 template <typename E>
 struct Result<void, E> {
   std::optional<E> error;
 
-  static auto Ok() -> Result { return Result{std::nullopt}; }
-  static auto Err(E err) -> Result { return Result{std::move(err)}; }
-  [[nodiscard]] auto is_ok() const -> bool { return !error.has_value(); }
-  [[nodiscard]] auto is_err() const -> bool { return error.has_value(); }
+  static constexpr auto Ok() -> Result { return Result{std::nullopt}; }
+  static constexpr auto Err(E err) -> Result {
+    return Result{std::move(err)};
+  }
+  [[nodiscard]] constexpr auto is_ok() const -> bool {
+    return !error.has_value();
+  }
+  [[nodiscard]] constexpr auto is_err() const -> bool {
+    return error.has_value();
+  }
+};
+
+// A chain's result after the step at `index`, as saved by checkpoint().
+template <typename T, typename E = std::string>
+struct Checkpoint {
+  std::size_t index = 0;
+  Result<T, E> result;
 };
 
 // Exported type aliases for user convenience
@@ -70,22 +96,25 @@ template <typename Step>
 struct Holder {
   Step* ptr;
 
-  explicit Holder(Step& ref) : ptr(&ref) {
+  constexpr explicit Holder(Step& ref) : ptr(&ref) {
     static_assert(!std::is_reference_v<Step>,
                   "Holder should not be used with reference types");
   }
 
-  auto get() -> Step& { return *ptr; }
+  constexpr auto get() -> Step& { return *ptr; }
 
   template <typename Continue, typename CurrentResult>
-  void call(Continue&& continue_chain, CurrentResult&& result) {
+  constexpr void call(Continue&& continue_chain, CurrentResult&& result) {
     if (result.is_err()) {
       continue_chain(std::forward<CurrentResult&&>(result));
       return;
     }
+    ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kThen, ptr);
     (*ptr)(
-        [continue_chain = std::forward<Continue&&>(continue_chain)](
-            auto next_result) mutable {
+        [continue_chain = std::forward<Continue&&>(continue_chain),
+         step = ptr](auto next_result) mutable {
+          ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kThen, step,
+                             next_result.is_err());
           continue_chain(std::move(next_result));
         },
         std::forward<CurrentResult&&>(result));
@@ -96,19 +125,23 @@ template <typename Step>
 struct CatcherHolder {
   Step* ptr;
 
-  explicit CatcherHolder(Step& ref) : ptr(&ref) {
+  constexpr explicit CatcherHolder(Step& ref) : ptr(&ref) {
     static_assert(!std::is_reference_v<Step>,
                   "CatcherHolder should not be used with reference types");
   }
 
-  auto get() -> Step& { return *ptr; }
+  constexpr auto get() -> Step& { return *ptr; }
 
   template <typename Continue, typename CurrentResult>
-  void call(Continue&& continue_chain, CurrentResult&& result) {
+  constexpr void call(Continue&& continue_chain, CurrentResult&& result) {
     if (result.is_err()) {
+      ASYNC_CHAIN_PROBE1(catch, ptr);
+      ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kCatch, ptr);
       (*ptr)(
-          [continue_chain = std::forward<Continue&&>(continue_chain)](
-              auto recovered_result) mutable {
+          [continue_chain = std::forward<Continue&&>(continue_chain),
+           step = ptr](auto recovered_result) mutable {
+            ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kCatch, step,
+                               recovered_result.is_err());
             continue_chain(std::move(recovered_result));
           },
           std::forward<CurrentResult&&>(result));
@@ -121,34 +154,49 @@ struct CatcherHolder {
 template <std::size_t MaxRetries, typename Step>
 struct RetryHolder {
 
-  explicit RetryHolder(Step& ref) : ptr(&ref) {
+  constexpr explicit RetryHolder(Step& ref) : ptr(&ref) {
     static_assert(!std::is_reference_v<Step>,
                   "RetryHolder should not be used with reference types");
   }
 
-  auto get() -> Step& { return *ptr; }
+  constexpr auto get() -> Step& { return *ptr; }
 
   template <typename Continue, typename CurrentResult>
-  void call(Continue&& continue_chain, CurrentResult&& result) {
+  constexpr void call(Continue&& continue_chain, CurrentResult&& result) {
     if (result.is_err()) {
       continue_chain(std::forward<CurrentResult&&>(result));
       return;
     }
-    run_step(std::forward<Continue&&>(continue_chain), 0);
+    run_step(ptr, std::forward<Continue&&>(continue_chain), 0);
   }
 
  private:
   Step* ptr;
 
+  // Static so the retry callback captures the step, not the holder: the holder
+  // lives in a chain frame that may be gone once the step completes
+  // asynchronously.
   template <typename Continue>
-  void run_step(Continue&& continue_chain, std::size_t attempt) {
-    (*ptr)(
-        [continue_chain = std::forward<Continue>(continue_chain), this,
+  static constexpr void run_step(Step* step, Continue&& continue_chain,
+                                 std::size_t attempt) {
+    if (attempt > 0) {
+      ASYNC_CHAIN_PROBE3(retry, detail::TraceKind::kRetry, step, attempt);
+      if constexpr (kStatsBuilt) {
+        if (!detail::constantEvaluated()) {
+          detail::recordRetry(attempt);
+        }
+      }
+    }
+    ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kRetry, step);
+    (*step)(
+        [continue_chain = std::forward<Continue>(continue_chain), step,
          attempt](auto result) mutable {
+          ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kRetry, step,
+                             result.is_err());
           if (result.is_ok() || attempt >= MaxRetries) {
             continue_chain(std::move(result));
           } else {
-            run_step(std::move(continue_chain), attempt + 1);
+            run_step(step, std::move(continue_chain), attempt + 1);
           }
         },
         attempt);
@@ -171,24 +219,35 @@ struct RetryDelayedHolder {
       continue_chain(std::forward<decltype(result)>(result));
       return;
     }
-    run_step(std::forward<Continue>(continue_chain), 0);
+    run_step(ptr, std::forward<Continue>(continue_chain), 0);
   }
 
  private:
   Step* ptr;
 
   template <typename Continue>
-  void run_step(Continue&& next, size_t attempt) {
-    (*ptr)(
+  static void run_step(Step* step, Continue&& next, size_t attempt) {
+    if (attempt > 0) {
+      ASYNC_CHAIN_PROBE3(retry, detail::TraceKind::kRetryDelayed, step,
+                         attempt);
+      if constexpr (kStatsBuilt) {
+        detail::recordRetry(attempt);
+      }
+    }
+    ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kRetryDelayed, step);
+    (*step)(
         [continue_chain = std::forward<Continue>(next), attempt,
-         this](auto result) mutable {
+         step](auto result) mutable {
+          ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kRetryDelayed, step,
+                             result.is_err());
           if (result.is_ok() || attempt >= MaxRetries) {
             continue_chain(std::move(result));
           } else {
+            ASYNC_CHAIN_PROBE2(scheduler_post, step, DelayMs);
             global_scheduler(
-                [this, continue_chain = std::move(continue_chain),
+                [step, continue_chain = std::move(continue_chain),
                  attempt]() mutable {
-                  run_step(std::move(continue_chain), attempt + 1);
+                  run_step(step, std::move(continue_chain), attempt + 1);
                 },
                 DelayMs);
           }
@@ -197,6 +256,499 @@ struct RetryDelayedHolder {
   }
 };
 
+// Saves successful results passing this point into `Store`, see
+// checkpoint.hpp for the stores; errors pass through unsaved.
+template <typename Store>
+struct CheckpointHolder {
+  Store* ptr;
+  std::size_t index;
+
+  CheckpointHolder(Store& ref, std::size_t position)
+      : ptr(&ref), index(position) {}
+
+  template <typename Continue, typename CurrentResult>
+  void call(Continue&& continue_chain, CurrentResult&& result) {
+    if (result.is_ok()) {
+      ptr->save(index, result);
+    }
+    continue_chain(std::forward<CurrentResult>(result));
+  }
+};
+
+// Runs `Steps` in order as one unit and reruns all of them, from the input
+// the group received, when any of them fails: up to MaxRetries more times,
+// after DelayMs on the global scheduler when DelayMs > 0. The input is kept in
+// the moving attempt state, so a retry copies it once and never touches the
+// steps before the group.
+template <std::size_t MaxRetries, std::size_t DelayMs, typename... Steps>
+struct RetryGroupHolder {
+  static_assert(sizeof...(Steps) > 0, "retryGroup needs at least one step");
+
+  explicit RetryGroupHolder(Steps&... refs) : ptrs(&refs...) {
+    static_assert((!std::is_reference_v<Steps> && ...),
+                  "RetryGroupHolder should not be used with reference types");
+  }
+
+  template <typename Continue, typename CurrentResult>
+  void call(Continue&& continue_chain, CurrentResult&& result) {
+    if (result.is_err()) {
+      continue_chain(std::forward<CurrentResult>(result));
+      return;
+    }
+    using R = std::decay_t<CurrentResult>;
+    startAttempt(Attempt<std::decay_t<Continue>, R>{
+        ptrs, std::forward<Continue>(continue_chain),
+        std::forward<CurrentResult>(result), 0});
+  }
+
+ private:
+  std::tuple<Steps*...> ptrs;
+
+  template <typename Continue, typename R>
+  struct Attempt {
+    std::tuple<Steps*...> steps;
+    Continue continue_chain;
+    R input;
+    std::size_t attempt;
+  };
+
+  static constexpr auto kKind = DelayMs > 0
+                                    ? detail::TraceKind::kRetryGroupDelayed
+                                    : detail::TraceKind::kRetryGroup;
+
+  template <typename Run>
+  static void startAttempt(Run run) {
+    auto input = run.input;
+    runStep<0>(std::move(run), std::move(input));
+  }
+
+  template <std::size_t Index, typename Run, typename R>
+  static void runStep(Run run, R result) {
+    if constexpr (Index < sizeof...(Steps)) {
+      if (result.is_ok()) {
+        auto* step = std::get<Index>(run.steps);
+        ASYNC_CHAIN_PROBE2(step_start, kKind, step);
+        (*step)(
+            [run = std::move(run), step](auto next_result) mutable {
+              ASYNC_CHAIN_PROBE3(step_end, kKind, step, next_result.is_err());
+              runStep<Index + 1>(std::move(run), R(std::move(next_result)));
+            },
+            std::move(result));
+        return;
+      }
+    }
+    finishAttempt(std::move(run), std::move(result));
+  }
+
+  template <typename Run, typename R>
+  static void finishAttempt(Run run, R result) {
+    if (result.is_ok() || run.attempt >= MaxRetries) {
+      run.continue_chain(std::move(result));
+      return;
+    }
+    ++run.attempt;
+    auto* first = std::get<0>(run.steps);
+    ASYNC_CHAIN_PROBE3(retry, kKind, first, run.attempt);
+    if constexpr (kStatsBuilt) {
+      detail::recordRetry(run.attempt);
+    }
+    if constexpr (DelayMs > 0) {
+      ASYNC_CHAIN_PROBE2(scheduler_post, first, DelayMs);
+      global_scheduler(
+          [run = std::move(run)]() mutable { startAttempt(std::move(run)); },
+          DelayMs);
+    } else {
+      startAttempt(std::move(run));
+    }
+  }
+};
+
+namespace detail {
+
+template <typename R, typename = void>
+struct ComparableValue : std::false_type {};
+
+template <typename R>
+struct ComparableValue<
+    R, std::void_t<decltype(*std::declval<const R&>().value ==
+                            *std::declval<const R&>().value)>>
+    : std::true_type {};
+
+// A successful validation confirms the prediction when it left the value
+// unchanged; thenSpeculative requires the value to have operator==.
+template <typename R>
+auto confirmsPrediction(const R& validated, const R& predicted) -> bool {
+  return *validated.value == *predicted.value;
+}
+
+// Shared by the validation and the speculative fetch; whichever finishes
+// second decides. `settled` is set once the chain has been continued or
+// handed to a rerun, after which a late speculative result is dropped.
+template <typename R, typename Continue>
+struct Speculation {
+  std::mutex mutex;
+  Continue continue_chain;
+  R predicted;
+  std::optional<R> speculative;
+  bool validated = false;
+  bool settled = false;
+
+  Speculation(Continue next, R input)
+      : continue_chain(std::move(next)), predicted(std::move(input)) {}
+};
+
+}  // namespace detail
+
+// Runs `fetch` on the current value while `validate` checks it. A
+// validation that succeeds with the value unchanged commits the speculative
+// result; a changed value reruns `fetch` on it, and a failed validation
+// continues with its error. A speculative fetch that lost cannot be stopped;
+// its result is discarded when it arrives.
+template <typename Validate, typename Fetch>
+struct SpeculativeHolder {
+  SpeculativeHolder(Validate& validate_ref, Fetch& fetch_ref)
+      : validate(&validate_ref), fetch(&fetch_ref) {
+    static_assert(!std::is_reference_v<Validate> &&
+                      !std::is_reference_v<Fetch>,
+                  "SpeculativeHolder should not be used with reference types");
+  }
+
+  template <typename Continue, typename CurrentResult>
+  void call(Continue&& continue_chain, CurrentResult&& result) {
+    if (result.is_err()) {
+      continue_chain(std::forward<CurrentResult>(result));
+      return;
+    }
+    using R = std::decay_t<CurrentResult>;
+    using State = detail::Speculation<R, std::decay_t<Continue>>;
+    auto state =
+        std::make_shared<State>(std::forward<Continue>(continue_chain), result);
+
+    ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kSpeculative, fetch);
+    (*fetch)(
+        [state, step = fetch](auto speculative) mutable {
+          ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kSpeculative, step,
+                             speculative.is_err());
+          std::unique_lock<std::mutex> lock(state->mutex);
+          if (state->settled) {
+            return;
+          }
+          if (!state->validated) {
+            state->speculative = std::move(speculative);
+            return;
+          }
+          state->settled = true;
+          lock.unlock();
+          settle(*state, detail::SpeculationOutcome::kCommitted,
+                 std::move(speculative));
+        },
+        result);
+
+    ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kSpeculative, validate);
+    (*validate)(
+        [state, step = validate, fetch = fetch](auto validated) mutable {
+          ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kSpeculative, step,
+                             validated.is_err());
+          std::unique_lock<std::mutex> lock(state->mutex);
+          if (validated.is_err()) {
+            state->settled = true;
+            lock.unlock();
+            settle(*state, detail::SpeculationOutcome::kDiscarded,
+                   std::move(validated));
+          } else if (!detail::confirmsPrediction(validated,
+                                                 state->predicted)) {
+            state->settled = true;
+            lock.unlock();
+            if constexpr (kStatsBuilt) {
+              detail::recordSpeculation(detail::SpeculationOutcome::kRerun);
+            }
+            ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kSpeculative,
+                               fetch);
+            (*fetch)(
+                [continue_chain = std::move(state->continue_chain),
+                 step = fetch](auto fetched) mutable {
+                  ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kSpeculative,
+                                     step, fetched.is_err());
+                  continue_chain(std::move(fetched));
+                },
+                std::move(validated));
+          } else if (state->speculative) {
+            state->settled = true;
+            lock.unlock();
+            settle(*state, detail::SpeculationOutcome::kCommitted,
+                   std::move(*state->speculative));
+          } else {
+            state->validated = true;
+          }
+        },
+        std::forward<CurrentResult>(result));
+  }
+
+ private:
+  Validate* validate;
+  Fetch* fetch;
+
+  template <typename State, typename R>
+  static void settle(State& state,
+                     [[maybe_unused]] detail::SpeculationOutcome outcome,
+                     R&& result) {
+    if constexpr (kStatsBuilt) {
+      detail::recordSpeculation(outcome);
+    }
+    state.continue_chain(std::forward<R>(result));
+  }
+};
+
+// Steps run in order as one branch of thenIf/thenSwitch; an error skips the
+// rest of the branch. Build with branch(steps...); a bare step passed as a
+// branch is a branch of one.
+template <typename... Steps>
+struct Branch {
+  std::tuple<Steps*...> steps;
+};
+
+template <typename... Steps>
+constexpr auto branch(Steps&... steps) -> Branch<Steps...> {
+  static_assert((!std::is_const_v<Steps> && ...),
+                "branch steps are called through non-const pointers");
+  return Branch<Steps...>{std::tuple<Steps*...>(&steps...)};
+}
+
+namespace detail {
+
+template <typename B>
+struct IsBranch : std::false_type {};
+
+template <typename... Steps>
+struct IsBranch<Branch<Steps...>> : std::true_type {};
+
+template <typename B>
+constexpr auto asBranch(B&& b) {
+  if constexpr (IsBranch<std::decay_t<B>>::value) {
+    return std::decay_t<B>(b);
+  } else {
+    static_assert(std::is_lvalue_reference_v<B>,
+                  "a step used as a branch must be an lvalue");
+    return branch(b);
+  }
+}
+
+template <typename B>
+using BranchOf = decltype(asBranch(std::declval<B>()));
+
+template <typename Pred>
+struct SelectIf {
+  Pred* pred;
+
+  template <typename R>
+  constexpr auto operator()(const R& result) const -> std::size_t {
+    return (*pred)(result) ? 0 : 1;
+  }
+};
+
+template <typename Selector>
+struct SelectBy {
+  Selector* selector;
+
+  template <typename R>
+  constexpr auto operator()(const R& result) const -> std::size_t {
+    return static_cast<std::size_t>((*selector)(result));
+  }
+};
+
+}  // namespace detail
+
+// Runs the branch whose index `select` returns for the current result, or
+// passes the result on when the index has no branch. Every branch is part of
+// the plan's type and frame; choosing one is a chain of index compares that
+// builds nothing for the others.
+template <typename Select, typename... Branches>
+struct SwitchHolder {
+  Select select;
+  std::tuple<Branches...> branches;
+
+  constexpr SwitchHolder(Select sel, Branches... alternatives)
+      : select(sel), branches(alternatives...) {}
+
+  template <typename Continue, typename CurrentResult>
+  constexpr void call(Continue&& continue_chain, CurrentResult&& result) {
+    if (result.is_err()) {
+      continue_chain(std::forward<CurrentResult>(result));
+      return;
+    }
+    const std::size_t index = select(std::as_const(result));
+    dispatch<0>(index, std::forward<Continue>(continue_chain),
+                std::forward<CurrentResult>(result));
+  }
+
+ private:
+  template <std::size_t B, typename Continue, typename R>
+  constexpr void dispatch(std::size_t index, Continue&& continue_chain,
+                          R&& result) {
+    if constexpr (B < sizeof...(Branches)) {
+      if (index == B) {
+        runStep<0>(std::get<B>(branches).steps,
+                   std::forward<Continue>(continue_chain),
+                   std::forward<R>(result));
+      } else {
+        dispatch<B + 1>(index, std::forward<Continue>(continue_chain),
+                        std::forward<R>(result));
+      }
+    } else {
+      continue_chain(std::forward<R>(result));
+    }
+  }
+
+  // Static so continuations capture the branch's step pointers, not the
+  // holder, like RetryHolder.
+  template <std::size_t Index, typename StepPtrs, typename Continue,
+            typename R>
+  static constexpr void runStep(const StepPtrs& steps,
+                                Continue&& continue_chain, R&& result) {
+    if constexpr (Index < std::tuple_size_v<StepPtrs>) {
+      if (result.is_ok()) {
+        auto* step = std::get<Index>(steps);
+        ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kBranch, step);
+        (*step)(
+            [steps, continue_chain = std::forward<Continue>(continue_chain),
+             step](auto next_result) mutable {
+              ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kBranch, step,
+                                 next_result.is_err());
+              runStep<Index + 1>(steps, std::move(continue_chain),
+                                 std::move(next_result));
+            },
+            std::forward<R>(result));
+        return;
+      }
+    }
+    continue_chain(std::forward<R>(result));
+  }
+};
+
+namespace detail {
+
+template <typename Pred>
+struct RepeatUntil {
+  Pred* pred;
+
+  [[nodiscard]] auto skip() const -> bool { return false; }
+
+  template <typename R>
+  auto done(const R& result, std::size_t /*iterations*/) const -> bool {
+    return (*pred)(result);
+  }
+};
+
+struct RepeatCount {
+  std::size_t count;
+
+  [[nodiscard]] auto skip() const -> bool { return count == 0; }
+
+  template <typename R>
+  auto done(const R& /*result*/, std::size_t iterations) const -> bool {
+    return iterations >= count;
+  }
+};
+
+}  // namespace detail
+
+// Runs `Step` on its own previous result until `Until` is done with it or an
+// iteration fails, then continues with the last result; with DelayMs > 0
+// every iteration after the first waits DelayMs on the global scheduler.
+// Iterations that complete synchronously are looped over rather than nested,
+// and a run allocates one loop state however many iterations it takes.
+template <typename Until, std::size_t DelayMs, typename Step>
+struct RepeatHolder {
+  Until until;
+  Step* ptr;
+
+  RepeatHolder(Until condition, Step& ref) : until(condition), ptr(&ref) {
+    static_assert(!std::is_reference_v<Step>,
+                  "RepeatHolder should not be used with reference types");
+  }
+
+  template <typename Continue, typename CurrentResult>
+  void call(Continue&& continue_chain, CurrentResult&& result) {
+    if (result.is_err() || until.skip()) {
+      continue_chain(std::forward<CurrentResult>(result));
+      return;
+    }
+    using State = Loop<std::decay_t<Continue>, std::decay_t<CurrentResult>>;
+    auto loop = std::make_shared<State>(
+        until, ptr, std::forward<Continue>(continue_chain));
+    loop->result.emplace(std::forward<CurrentResult>(result));
+    drive(std::move(loop));
+  }
+
+ private:
+  enum Phase : int { kRunning, kReturned, kCompleted };
+
+  // `phase` tells the driver and the continuation which of them moves on:
+  // whichever finds the other already done with the iteration.
+  template <typename Continue, typename R>
+  struct Loop {
+    Until until;
+    Step* step;
+    Continue continue_chain;
+    std::optional<R> result;
+    std::size_t iterations = 0;
+    std::atomic<int> phase{kRunning};
+
+    Loop(Until condition, Step* s, Continue continue_with)
+        : until(condition),
+          step(s),
+          continue_chain(std::move(continue_with)) {}
+  };
+
+  template <typename LoopPtr>
+  static void drive(LoopPtr loop) {
+    do {
+      loop->phase.store(kRunning, std::memory_order_relaxed);
+      auto input = std::move(*loop->result);
+      loop->result.reset();
+      ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kRepeat, loop->step);
+      (*loop->step)(
+          [loop](auto next_result) {
+            ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kRepeat,
+                               loop->step, next_result.is_err());
+            loop->result.emplace(std::move(next_result));
+            if (loop->phase.exchange(kCompleted, std::memory_order_acq_rel) ==
+                    kReturned &&
+                advance(loop)) {
+              drive(loop);
+            }
+          },
+          std::move(input));
+      if (loop->phase.exchange(kReturned, std::memory_order_acq_rel) !=
+          kCompleted) {
+        return;
+      }
+    } while (advance(loop));
+  }
+
+  // After an iteration: true when the next one should run right away. The
+  // continuation is moved out first, as running it may drop the last
+  // reference to the loop.
+  template <typename LoopPtr>
+  static auto advance(const LoopPtr& loop) -> bool {
+    ++loop->iterations;
+    if (loop->result->is_err() ||
+        loop->until.done(*loop->result, loop->iterations)) {
+      auto continue_chain = std::move(loop->continue_chain);
+      auto result = std::move(*loop->result);
+      loop->result.reset();
+      continue_chain(std::move(result));
+      return false;
+    }
+    if constexpr (DelayMs > 0) {
+      ASYNC_CHAIN_PROBE2(scheduler_post, loop->step, DelayMs);
+      global_scheduler([loop] { drive(loop); }, DelayMs);
+      return false;
+    }
+    return true;
+  }
+};
+
 template <typename T, typename E, typename... StepHolders>
 class AsyncChain {
  public:
@@ -206,31 +758,32 @@ class AsyncChain {
   auto operator=(AsyncChain&&) -> AsyncChain& = delete;
   ~AsyncChain() = default;
 
-  explicit AsyncChain(StepHolders&&... holders)
+  constexpr explicit AsyncChain(StepHolders&&... holders)
       : steps_(std::forward<StepHolders>(holders)...) {}
 
   template <typename... OldSteps, typename NewStep>
-  AsyncChain(std::tuple<OldSteps...>&& old_steps, NewStep&& new_step)
+  constexpr AsyncChain(std::tuple<OldSteps...>&& old_steps,
+                       NewStep&& new_step)
       : steps_(
             std::tuple_cat(std::move(old_steps),
                            std::make_tuple(std::forward<NewStep>(new_step)))) {}
 
   template <typename Step>
-  auto then(Step&& step) && {
+  constexpr auto then(Step&& step) && {
     using NewHolder = Holder<std::decay_t<Step>>;
     return AsyncChain<T, E, StepHolders..., NewHolder>(
         std::move(steps_), NewHolder(std::forward<Step>(step)));
   }
 
   template <std::size_t MaxRetries, typename Step>
-  auto thenWithRetry(Step&& step) && {
+  constexpr auto thenWithRetry(Step&& step) && {
     using NewHolder = RetryHolder<MaxRetries, std::decay_t<Step>>;
     return AsyncChain<T, E, StepHolders..., NewHolder>(
         std::move(steps_), NewHolder(std::forward<Step>(step)));
   }
 
   template <typename Catcher>
-  auto catchError(Catcher&& catcher) && {
+  constexpr auto catchError(Catcher&& catcher) && {
     using CatchHolder = CatcherHolder<std::decay_t<Catcher>>;
     return AsyncChain<T, E, StepHolders..., CatchHolder>(
         std::move(steps_), CatchHolder(std::forward<Catcher>(catcher)));
@@ -244,21 +797,270 @@ class AsyncChain {
         std::move(steps_), NewHolder(std::forward<Step>(step)));
   }
 
+  // Retries `steps...` together, see RetryGroupHolder.
+  template <std::size_t MaxRetries, typename... Steps>
+  auto retryGroup(Steps&&... steps) && {
+    static_assert((std::is_lvalue_reference_v<Steps> && ...),
+                  "retryGroup keeps pointers to its steps");
+    using NewHolder = RetryGroupHolder<MaxRetries, 0, std::decay_t<Steps>...>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(std::move(steps_),
+                                                       NewHolder(steps...));
+  }
+
+  template <std::size_t MaxRetries, std::size_t DelayMs, typename... Steps>
+  auto retryGroupDelayed(Steps&&... steps) && {
+    static_assert(DelayMs > 0, "use retryGroup for retries without delay");
+    static_assert((std::is_lvalue_reference_v<Steps> && ...),
+                  "retryGroup keeps pointers to its steps");
+    using NewHolder =
+        RetryGroupHolder<MaxRetries, DelayMs, std::decay_t<Steps>...>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(std::move(steps_),
+                                                       NewHolder(steps...));
+  }
+
+  // Continues with `then_branch` when `pred(result)` holds and with
+  // `else_branch` otherwise; each is a branch(steps...) or a single step.
+  template <typename Pred, typename Then, typename Else = Branch<>>
+  constexpr auto thenIf(Pred&& pred, Then&& then_branch,
+                        Else&& else_branch = Else{}) && {
+    static_assert(std::is_lvalue_reference_v<Pred>,
+                  "thenIf keeps a pointer to its predicate");
+    using Select = detail::SelectIf<std::remove_reference_t<Pred>>;
+    using NewHolder = SwitchHolder<Select, detail::BranchOf<Then>,
+                                   detail::BranchOf<Else>>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(
+        std::move(steps_),
+        NewHolder(Select{&pred},
+                  detail::asBranch(std::forward<Then>(then_branch)),
+                  detail::asBranch(std::forward<Else>(else_branch))));
+  }
+
+  // Continues with the branch at the index `selector(result)` returns (an
+  // integer or enum), or with the result unchanged when there is none.
+  template <typename Selector, typename... Branches>
+  constexpr auto thenSwitch(Selector&& selector, Branches&&... branches) && {
+    static_assert(std::is_lvalue_reference_v<Selector>,
+                  "thenSwitch keeps a pointer to its selector");
+    using Select = detail::SelectBy<std::remove_reference_t<Selector>>;
+    using NewHolder = SwitchHolder<Select, detail::BranchOf<Branches>...>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(
+        std::move(steps_),
+        NewHolder(Select{&selector},
+                  detail::asBranch(std::forward<Branches>(branches))...));
+  }
+
+  // Runs `step` on its own result until `pred(result)` holds, e.g. to fetch
+  // pages until the last one; see RepeatHolder.
+  template <typename Pred, typename Step>
+  auto thenRepeatUntil(Pred&& pred, Step&& step) && {
+    return std::move(*this).template thenRepeatUntilDelayed<0>(
+        std::forward<Pred>(pred), std::forward<Step>(step));
+  }
+
+  // thenRepeatUntil waiting DelayMs on the scheduler between iterations,
+  // e.g. to poll.
+  template <std::size_t DelayMs, typename Pred, typename Step>
+  auto thenRepeatUntilDelayed(Pred&& pred, Step&& step) && {
+    static_assert(std::is_lvalue_reference_v<Pred>,
+                  "thenRepeatUntil keeps a pointer to its predicate");
+    static_assert(std::is_lvalue_reference_v<Step>,
+                  "thenRepeatUntil keeps a pointer to its step");
+    using Until = detail::RepeatUntil<std::remove_reference_t<Pred>>;
+    using NewHolder = RepeatHolder<Until, DelayMs, std::decay_t<Step>>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(
+        std::move(steps_), NewHolder(Until{&pred}, step));
+  }
+
+  // Runs `step` `count` times, each on the previous result.
+  template <typename Step>
+  auto thenRepeatN(std::size_t count, Step&& step) && {
+    return std::move(*this).template thenRepeatNDelayed<0>(
+        count, std::forward<Step>(step));
+  }
+
+  template <std::size_t DelayMs, typename Step>
+  auto thenRepeatNDelayed(std::size_t count, Step&& step) && {
+    static_assert(std::is_lvalue_reference_v<Step>,
+                  "thenRepeatN keeps a pointer to its step");
+    using NewHolder =
+        RepeatHolder<detail::RepeatCount, DelayMs, std::decay_t<Step>>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(
+        std::move(steps_), NewHolder(detail::RepeatCount{count}, step));
+  }
+
+  // Saves the result at this point into `store`; a later execution of the
+  // same plan can resume() from it.
+  template <typename Store>
+  auto checkpoint(Store& store) && {
+    using NewHolder = CheckpointHolder<Store>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(
+        std::move(steps_), NewHolder(store, sizeof...(StepHolders)));
+  }
+
+  // See SpeculativeHolder: `fetch` starts on the current value while
+  // `validate` runs.
+  template <typename Validate, typename Fetch>
+  auto thenSpeculative(Validate&& validate, Fetch&& fetch) && {
+    static_assert(std::is_lvalue_reference_v<Validate> &&
+                      std::is_lvalue_reference_v<Fetch>,
+                  "thenSpeculative keeps pointers to its steps");
+    static_assert(detail::ComparableValue<Result<T, E>>::value,
+                  "thenSpeculative compares the validated value with the "
+                  "prediction, so T needs operator==");
+    using NewHolder =
+        SpeculativeHolder<std::decay_t<Validate>, std::decay_t<Fetch>>;
+    return AsyncChain<T, E, StepHolders..., NewHolder>(
+        std::move(steps_), NewHolder(validate, fetch));
+  }
+
+  // Bytes of holders this plan carries from step to step. A holder is
+  // mostly one pointer per step; branching holders carry their branches,
+  // repeats their condition and checkpoints their step index. The steps
+  // themselves live wherever the caller keeps them.
+  static constexpr std::size_t kFrameBytes =
+      sizeof(std::tuple<StepHolders...>);
+
+  // What each continuation of a running chain captures: the holders plus the
+  // final callback. Builds with stats or step timing add a few words, and a
+  // step that parks its continuation in a std::function may heap-allocate it.
   template <typename FinalCallback>
-  void finally(FinalCallback&& final_callback) && {
-    call_steps<0>(std::move(steps_),
-                  std::forward<FinalCallback>(final_callback),
-                  Result<T, E>::Ok(T{}));
+  static constexpr auto frameBytes() -> std::size_t {
+    return kFrameBytes + sizeof(std::decay_t<FinalCallback>);
+  }
+
+  // Per-step wall and CPU time of this plan, see setStepTiming().
+  static auto stepTimings() -> PlanTimings {
+    return detail::snapshot(timingCounters());
+  }
+
+  // Index of this plan in collected stats; name it with nameStatsPlan().
+  static auto statsPlan() -> std::size_t { return statsSlot().id; }
+
+  template <typename FinalCallback>
+  constexpr void finally(FinalCallback&& final_callback) && {
+    std::move(*this).start(
+        std::forward<FinalCallback>(final_callback),
+        [](auto&& steps, auto&& final) {
+          call_steps<0>(std::move(steps), std::forward<decltype(final)>(final),
+                        Result<T, E>::Ok(T{}));
+        });
+  }
+
+  // Runs the steps after `from.index` with `from.result`, skipping the
+  // prefix a previous execution completed. Throws std::out_of_range when the
+  // index is not a step of this plan.
+  template <typename FinalCallback>
+  void resume(Checkpoint<T, E> from, FinalCallback&& final_callback) && {
+    if (from.index >= sizeof...(StepHolders)) {
+      throw std::out_of_range("resume: plan has no step " +
+                              std::to_string(from.index));
+    }
+    std::move(*this).start(
+        std::forward<FinalCallback>(final_callback),
+        [&from](auto&& steps, auto&& final) {
+          resume_at<0>(std::move(steps), from.index,
+                       std::forward<decltype(final)>(final),
+                       std::move(from.result));
+        });
+  }
+
+  // Runs the chain and returns its result; every step must continue before
+  // it returns. When the steps are constexpr, T and E are literal types and
+  // only then, catchError, thenWithRetry, thenIf and thenSwitch are used,
+  // this is a constant expression, so a pure chain can be evaluated at
+  // compile time:
+  //
+  //   constexpr auto kParams = [] {
+  //     auto tune = [](auto next, Result<Params, int> in) { ... };
+  //     return initAsyncChain<Params, int>().then(tune).evaluate();
+  //   }();
+  //
+  // Throws std::logic_error when a step has not continued by then.
+  constexpr auto evaluate() && -> Result<T, E> {
+    Result<T, E> out{};
+    bool done = false;
+    std::move(*this).finally([&out, &done](auto&& result) {
+      out = std::forward<decltype(result)>(result);
+      done = true;
+    });
+    if (!done) {
+      throw std::logic_error("evaluate: a step did not continue in place");
+    }
+    return out;
   }
 
  private:
   std::tuple<StepHolders...> steps_;
 
+  static auto statsSlot() -> const detail::StatsPlan& {
+    static const detail::StatsPlan plan =
+        detail::registerStatsPlan(sizeof...(StepHolders));
+    return plan;
+  }
+
+  static auto timingCounters() -> detail::PlanCounters& {
+    return detail::planCounters<AsyncChain, sizeof...(StepHolders)>();
+  }
+
+  // Hands the steps and the final callback, wrapped for stats when built,
+  // to `entry`, which calls the first step to run.
+  template <typename FinalCallback, typename Entry>
+  constexpr void start(FinalCallback&& final_callback, Entry&& entry) && {
+    if constexpr (kStatsBuilt) {
+      if (!detail::constantEvaluated()) {
+        constexpr auto frame_bytes = frameBytes<FinalCallback>();
+        detail::recordChainStarted(frame_bytes);
+        entry(std::move(steps_),
+              [final_callback = std::forward<FinalCallback>(final_callback),
+               started = detail::nowNs()](auto&& result) mutable {
+                std::optional<std::int64_t> error;
+                if (result.is_err()) {
+                  error = StatsErrorCode<E>::of(*result.error);
+                }
+                detail::recordChainDone(statsPlan(),
+                                        detail::nowNs() - started, error,
+                                        frame_bytes);
+                final_callback(std::forward<decltype(result)>(result));
+              });
+        return;
+      }
+    }
+    entry(std::move(steps_), std::forward<FinalCallback>(final_callback));
+  }
+
+  // Turns a runtime step index into call_steps<Index + 1>.
+  template <std::size_t Index, typename StepsTuple, typename FinalCallback>
+  static void resume_at(StepsTuple&& steps, std::size_t index,
+                        FinalCallback&& final_callback, Result<T, E>&& result) {
+    if constexpr (Index < sizeof...(StepHolders)) {
+      if (index == Index) {
+        call_steps<Index + 1>(std::forward<StepsTuple>(steps),
+                              std::forward<FinalCallback>(final_callback),
+                              std::move(result));
+      } else {
+        resume_at<Index + 1>(std::forward<StepsTuple>(steps), index,
+                             std::forward<FinalCallback>(final_callback),
+                             std::move(result));
+      }
+    }
+  }
+
   template <std::size_t Index, typename StepsTuple, typename FinalCallback,
             typename CurrentResult>
-  static void call_steps(StepsTuple&& steps, FinalCallback&& final_callback,
-                         CurrentResult&& result) {
+  static constexpr void call_steps(StepsTuple&& steps,
+                                   FinalCallback&& final_callback,
+                                   CurrentResult&& result) {
     if constexpr (Index < std::tuple_size_v<std::decay_t<StepsTuple>>) {
+      if constexpr (kStatsBuilt || kStepTimingBuilt) {
+        if (!detail::constantEvaluated() &&
+            (kStatsBuilt ||
+             detail::step_timing_enabled.load(std::memory_order_relaxed))) {
+          call_step_timed<Index>(std::forward<StepsTuple>(steps),
+                                 std::forward<FinalCallback>(final_callback),
+                                 std::forward<CurrentResult>(result));
+          return;
+        }
+      }
       auto& holder = std::get<Index>(steps);
 
       // Define a small continuation
@@ -272,13 +1074,54 @@ class AsyncChain {
       holder.call(std::forward<decltype(continue_chain)>(continue_chain),
                   std::forward<CurrentResult>(result));
     } else {
+      ASYNC_CHAIN_PROBE1(chain_done, result.is_err());
       final_callback(std::forward<CurrentResult>(result));
     }
   }
+
+  // call_steps with step timing or stats on; kept separate so the plain
+  // continuation stays as small as it was.
+  template <std::size_t Index, typename StepsTuple, typename FinalCallback,
+            typename CurrentResult>
+  static void call_step_timed(StepsTuple&& steps,
+                              FinalCallback&& final_callback,
+                              CurrentResult&& result) {
+    auto& holder = std::get<Index>(steps);
+    detail::StepCounters* timing = nullptr;
+    std::uint64_t started = 0;
+    if (kStepTimingBuilt &&
+        detail::step_timing_enabled.load(std::memory_order_relaxed)) {
+      timing = &timingCounters().steps[Index];
+      started = detail::stepBegin(*timing);
+    } else {
+      started = detail::nowNs();
+    }
+
+    auto continue_chain = [steps = std::forward<StepsTuple>(steps),
+                           final_callback =
+                               std::forward<FinalCallback>(final_callback),
+                           timing, started](auto&& next_result) mutable {
+      const auto wall_ns = timing != nullptr
+                               ? detail::stepEnd(*timing, started)
+                               : detail::nowNs() - started;
+      if constexpr (kStatsBuilt) {
+        detail::recordStepLatency(statsSlot().first_step_row, Index,
+                                  wall_ns);
+      }
+      call_steps<Index + 1>(std::move(steps), std::move(final_callback),
+                            std::forward<decltype(next_result)>(next_result));
+    };
+
+    holder.call(std::move(continue_chain), std::forward<CurrentResult>(result));
+    // The step went asynchronous: its synchronous segment ends here.
+    if (timing != nullptr) {
+      detail::closeSegment(*timing);
+    }
+  }
 };
 
 template <typename T, typename E>
-auto initAsyncChain() {
+constexpr auto initAsyncChain() {
   return AsyncChain<T, E>{};
 }
 
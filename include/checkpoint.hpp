@@ -0,0 +1,302 @@
+#ifndef WORKSPACES_CPP20_CHECKPOINT_HPP
+#define WORKSPACES_CPP20_CHECKPOINT_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include "async.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace async_chain {
+
+// Checkpoint stores are passed to AsyncChain::checkpoint() and must provide
+//
+//   void save(std::size_t index, const Result<T, E>& result);
+//   auto load() const -> std::optional<Checkpoint<T, E>>;
+//   void clear();
+//
+// save() may be called from any thread a step completes on. A store keeps
+// the latest checkpoint only.
+
+template <typename T, typename E = std::string>
+class MemoryCheckpointStore {
+ public:
+  void save(std::size_t index, const Result<T, E>& result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    saved_ = Checkpoint<T, E>{index, result};
+  }
+
+  [[nodiscard]] auto load() const -> std::optional<Checkpoint<T, E>> {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return saved_;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    saved_.reset();
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::optional<Checkpoint<T, E>> saved_;
+};
+
+// Byte encoding of checkpointed values for MappedCheckpointStore. Trivially
+// copyable types and std::string are provided; specialize for others.
+template <typename V, typename = void>
+struct CheckpointCodec;
+
+template <typename V>
+struct CheckpointCodec<V, std::enable_if_t<std::is_trivially_copyable_v<V>>> {
+  static void encode(const V& value, std::string& out) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(V));
+  }
+
+  static auto decode(const char* data, std::size_t size) -> std::optional<V> {
+    if (size != sizeof(V)) {
+      return std::nullopt;
+    }
+    V value;
+    std::memcpy(&value, data, sizeof(V));
+    return value;
+  }
+};
+
+template <>
+struct CheckpointCodec<std::string> {
+  static void encode(const std::string& value, std::string& out) {
+    out += value;
+  }
+
+  static auto decode(const char* data, std::size_t size)
+      -> std::optional<std::string> {
+    return std::string(data, size);
+  }
+};
+
+// One of the two checkpoints a file holds. Its payload is `size` bytes at
+// `offset` from the start of the file, in a region of `capacity` bytes.
+struct CheckpointSlot {
+  // Zero while the slot is empty or being written.
+  std::atomic<std::uint64_t> generation;
+  std::uint64_t index;
+  std::uint64_t is_err;
+  std::uint64_t offset;
+  std::uint64_t capacity;
+  std::uint64_t size;
+};
+
+// Layout of a checkpoint file. The slot with the highest generation is the
+// checkpoint. A save clears the generation of the other slot, writes its
+// payload and fields, and stores a higher generation last, so a save cut
+// short leaves the previous checkpoint in place.
+struct CheckpointFileHeader {
+  static constexpr std::uint64_t kMagic = 0x54504b4348434143ULL;
+  static constexpr std::uint32_t kVersion = 2;
+
+  std::uint64_t magic;
+  std::uint32_t version;
+  CheckpointSlot slots[2];
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// Keeps the latest checkpoint in a memory-mapped file, so it survives the
+// process and a new one can resume. Payloads are written to a slot other
+// than the current checkpoint's, and the file grows when a payload does not
+// fit its slot. Data reaches the page cache on save(); call sync() where it
+// must also survive a power loss.
+template <typename T, typename E = std::string>
+class MappedCheckpointStore {
+ public:
+  explicit MappedCheckpointStore(std::string path) : path_(std::move(path)) {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      fail();
+    }
+    try {
+      struct stat info {};
+      if (::fstat(fd_, &info) != 0) {
+        fail();
+      }
+      const auto size = static_cast<std::size_t>(info.st_size);
+      mapped_size_ = std::max(size, sizeof(CheckpointFileHeader));
+      mapped_ = map(mapped_size_);
+      if (size < sizeof(CheckpointFileHeader) ||
+          header()->magic != CheckpointFileHeader::kMagic ||
+          header()->version != CheckpointFileHeader::kVersion) {
+        for (auto& slot : header()->slots) {
+          slot.generation.store(0, std::memory_order_relaxed);
+          slot.offset = 0;
+          slot.capacity = 0;
+        }
+        header()->magic = CheckpointFileHeader::kMagic;
+        header()->version = CheckpointFileHeader::kVersion;
+      }
+    } catch (...) {
+      ::close(fd_);
+      throw;
+    }
+  }
+
+  MappedCheckpointStore(const MappedCheckpointStore&) = delete;
+  auto operator=(const MappedCheckpointStore&)
+      -> MappedCheckpointStore& = delete;
+
+  ~MappedCheckpointStore() {
+    if (mapped_ != nullptr) {
+      ::munmap(mapped_, mapped_size_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  void save(std::size_t index, const Result<T, E>& result) {
+    std::string payload;
+    if (result.is_err()) {
+      CheckpointCodec<E>::encode(*result.error, payload);
+    } else {
+      CheckpointCodec<T>::encode(*result.value, payload);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto* current = committed();
+    auto& slots = header()->slots;
+    const std::size_t target = current == &slots[0] ? 1 : 0;
+    const auto generation =
+        current == nullptr
+            ? 1
+            : current->generation.load(std::memory_order_relaxed) + 1;
+    slots[target].generation.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (payload.size() > slots[target].capacity ||
+        slots[target].offset + slots[target].capacity > mapped_size_) {
+      // A new region at the end of the file, which another store on it may
+      // have grown; the old region is left unused.
+      const auto capacity =
+          std::max<std::size_t>(payload.size(), 2 * slots[target].capacity);
+      struct stat info {};
+      if (::fstat(fd_, &info) != 0) {
+        fail();
+      }
+      const auto offset =
+          std::max(mapped_size_, static_cast<std::size_t>(info.st_size));
+      void* grown = map(offset + capacity);
+      ::munmap(mapped_, mapped_size_);
+      mapped_ = grown;
+      mapped_size_ = offset + capacity;
+      header()->slots[target].offset = offset;
+      header()->slots[target].capacity = capacity;
+    }
+    auto& slot = header()->slots[target];
+    std::memcpy(static_cast<char*>(mapped_) + slot.offset, payload.data(),
+                payload.size());
+    slot.index = index;
+    slot.is_err = result.is_err() ? 1 : 0;
+    slot.size = payload.size();
+    slot.generation.store(generation, std::memory_order_release);
+  }
+
+  [[nodiscard]] auto load() const -> std::optional<Checkpoint<T, E>> {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto* slot = committed();
+    if (slot == nullptr) {
+      return std::nullopt;
+    }
+    const auto* data = static_cast<const char*>(mapped_) + slot->offset;
+    const auto size = static_cast<std::size_t>(slot->size);
+    const auto index = static_cast<std::size_t>(slot->index);
+    if (slot->is_err != 0) {
+      auto error = CheckpointCodec<E>::decode(data, size);
+      if (!error) {
+        return std::nullopt;
+      }
+      return Checkpoint<T, E>{index, Result<T, E>::Err(std::move(*error))};
+    }
+    auto value = CheckpointCodec<T>::decode(data, size);
+    if (!value) {
+      return std::nullopt;
+    }
+    return Checkpoint<T, E>{index, Result<T, E>::Ok(std::move(*value))};
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& slot : header()->slots) {
+      slot.generation.store(0, std::memory_order_release);
+    }
+  }
+
+  void sync() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ::msync(mapped_, mapped_size_, MS_SYNC);
+  }
+
+ private:
+  std::string path_;
+  int fd_ = -1;
+  void* mapped_ = nullptr;
+  std::size_t mapped_size_ = 0;
+  mutable std::mutex mutex_;
+
+  auto header() const -> CheckpointFileHeader* {
+    return static_cast<CheckpointFileHeader*>(mapped_);
+  }
+
+  // The slot holding the checkpoint, or null when there is none. A slot
+  // whose payload lies outside the file is ignored.
+  auto committed() const -> const CheckpointSlot* {
+    const CheckpointSlot* latest = nullptr;
+    std::uint64_t latest_generation = 0;
+    for (const auto& slot : header()->slots) {
+      const auto generation = slot.generation.load(std::memory_order_acquire);
+      if (generation > latest_generation && slot.size <= slot.capacity &&
+          slot.offset + slot.capacity <= mapped_size_) {
+        latest = &slot;
+        latest_generation = generation;
+      }
+    }
+    return latest;
+  }
+
+  // Grows the file to at least `size` bytes and maps it. The current
+  // mapping is left to the caller, so a failure keeps it usable.
+  auto map(std::size_t size) -> void* {
+    if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+      fail();
+    }
+    void* mapped =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapped == MAP_FAILED) {
+      fail();
+    }
+    return mapped;
+  }
+
+  [[noreturn]] void fail() {
+    throw std::system_error(errno, std::generic_category(), path_);
+  }
+};
+
+#endif
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef WORKSPACES_CPP20_DAG_HPP
+#define WORKSPACES_CPP20_DAG_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async.hpp"
+#include "trace.hpp"
+
+namespace async_chain {
+
+// A DAG node receives the results of its predecessors, in the order they
+// were declared; a node without predecessors receives the graph's input.
+template <typename T, typename E = std::string>
+using DagStep =
+    std::function<void(NextType<T, E>, std::vector<Result<T, E>>)>;
+
+// Steps with declared predecessors. Every run allocates one frame holding an
+// atomic count of unfinished inputs per node; the node whose completion
+// brings a successor's count to zero launches it, on its own thread. Steps
+// that complete asynchronously therefore overlap, and a run takes as long as
+// the graph's longest path rather than the sum of its steps.
+//
+// A node whose inputs include an error is not called; it completes with the
+// first such error, which so reaches every dependent. Like chain steps, the
+// graph must outlive its runs.
+//
+//   Dag<int> dag;
+//   auto a = dag.node(load);
+//   auto b = dag.node(left, {a});
+//   auto c = dag.node(right, {a});
+//   dag.node(merge, {b, c});
+//   initAsyncChain<int, std::string>().then(dag).finally(done);
+template <typename T, typename E = std::string>
+class Dag {
+ public:
+  using NodeId = std::size_t;
+  using ResultType = Result<T, E>;
+
+  // Predecessors must already be in the graph, so it is acyclic by
+  // construction. Throws std::invalid_argument otherwise.
+  auto node(DagStep<T, E> step, std::vector<NodeId> after = {}) -> NodeId {
+    const NodeId id = nodes_.size();
+    for (auto pred : after) {
+      if (pred >= id) {
+        throw std::invalid_argument("Dag::node: unknown predecessor " +
+                                    std::to_string(pred));
+      }
+    }
+    for (auto pred : after) {
+      nodes_[pred].successors.push_back(id);
+    }
+    nodes_.push_back(Node{std::move(step), std::move(after), {}});
+    output_ = id;
+    return id;
+  }
+
+  // The node whose result a run used as a chain step continues with; the
+  // last node added unless set.
+  void setOutput(NodeId id) { output_ = id; }
+
+  [[nodiscard]] auto size() const -> std::size_t { return nodes_.size(); }
+
+  // Nodes on the longest path, i.e. the steps a run waits for in sequence.
+  [[nodiscard]] auto depth() const -> std::size_t {
+    std::vector<std::size_t> longest(nodes_.size(), 1);
+    std::size_t out = 0;
+    for (NodeId id = 0; id < nodes_.size(); ++id) {
+      for (auto pred : nodes_[id].after) {
+        longest[id] = std::max(longest[id], longest[pred] + 1);
+      }
+      out = std::max(out, longest[id]);
+    }
+    return out;
+  }
+
+  // Runs every node and calls `final_callback` with all results, indexed by
+  // node id, once the last one completes.
+  template <typename FinalCallback>
+  void run(ResultType input, FinalCallback&& final_callback) const {
+    using Frame = RunFrame<std::decay_t<FinalCallback>>;
+    if (nodes_.empty()) {
+      final_callback(std::vector<ResultType>{});
+      return;
+    }
+    auto frame = std::make_shared<Frame>(
+        this, std::move(input), std::forward<FinalCallback>(final_callback));
+    for (NodeId id = 0; id < nodes_.size(); ++id) {
+      if (nodes_[id].after.empty()) {
+        launch(frame, id);
+      }
+    }
+  }
+
+  // A graph is a chain step: it continues with its output node's result.
+  template <typename Next>
+  void operator()(Next next, ResultType input) const {
+    if (nodes_.empty()) {
+      next(std::move(input));
+      return;
+    }
+    run(std::move(input), [next = std::move(next), output = output_](
+                              std::vector<ResultType> results) mutable {
+      next(std::move(results[output]));
+    });
+  }
+
+ private:
+  struct Node {
+    DagStep<T, E> step;
+    std::vector<NodeId> after;
+    std::vector<NodeId> successors;
+  };
+
+  struct NodeState {
+    std::atomic<std::size_t> pending{0};
+    std::optional<ResultType> result;
+  };
+
+  // A node's result is written before it decrements its successors'
+  // counters, so the launching decrement (acq_rel) makes it visible.
+  template <typename FinalCallback>
+  struct RunFrame {
+    const Dag* graph;
+    ResultType input;
+    FinalCallback final_callback;
+    std::vector<NodeState> states;
+    std::atomic<std::size_t> remaining;
+
+    RunFrame(const Dag* dag, ResultType in, FinalCallback callback)
+        : graph(dag),
+          input(std::move(in)),
+          final_callback(std::move(callback)),
+          states(dag->nodes_.size()),
+          remaining(dag->nodes_.size()) {
+      for (std::size_t id = 0; id < states.size(); ++id) {
+        states[id].pending.store(dag->nodes_[id].after.size(),
+                                 std::memory_order_relaxed);
+      }
+    }
+  };
+
+  std::vector<Node> nodes_;
+  NodeId output_ = 0;
+
+  template <typename Frame>
+  static void launch(const std::shared_ptr<Frame>& frame, NodeId id) {
+    const auto& node = frame->graph->nodes_[id];
+    std::vector<ResultType> inputs;
+    if (node.after.empty()) {
+      inputs.push_back(frame->input);
+    }
+    for (auto pred : node.after) {
+      const auto& result = *frame->states[pred].result;
+      if (result.is_err()) {
+        complete(frame, id, ResultType(result));
+        return;
+      }
+      inputs.push_back(result);
+    }
+    ASYNC_CHAIN_PROBE2(step_start, detail::TraceKind::kDagNode, id);
+    node.step(
+        [frame, id](ResultType result) {
+          ASYNC_CHAIN_PROBE3(step_end, detail::TraceKind::kDagNode, id,
+                             result.is_err());
+          complete(frame, id, std::move(result));
+        },
+        std::move(inputs));
+  }
+
+  template <typename Frame>
+  static void complete(const std::shared_ptr<Frame>& frame, NodeId id,
+                       ResultType result) {
+    frame->states[id].result = std::move(result);
+    for (auto next : frame->graph->nodes_[id].successors) {
+      if (frame->states[next].pending.fetch_sub(
+              1, std::memory_order_acq_rel) == 1) {
+        launch(frame, next);
+      }
+    }
+    if (frame->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::vector<ResultType> results;
+      results.reserve(frame->states.size());
+      for (auto& state : frame->states) {
+        results.push_back(std::move(*state.result));
+      }
+      frame->final_callback(std::move(results));
+    }
+  }
+};
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef WORKSPACES_CPP20_DEBOUNCE_HPP
+#define WORKSPACES_CPP20_DEBOUNCE_HPP
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include "async.hpp"
+
+namespace async_chain {
+
+// Stages in front of a chain for bursty event streams. `run(value)` starts
+// the chain; an event superseded by a later one is dropped before any chain
+// is built for it. Each stage has at most one timer pending on its scheduler
+// (global_scheduler unless given), however many events arrive. Timers hold
+// the stage weakly, so one firing after the stage is destroyed does nothing.
+
+// Runs once the events have been quiet for `quiet`, with the latest value.
+// The timer is armed by the first event of a burst; when it fires early
+// because later events arrived, it re-arms for the rest of the quiet period
+// measured from the last one. A scheduler that runs tasks inline cannot
+// wait, so on one every event runs at once.
+template <typename T>
+class Debounce {
+ public:
+  Debounce(std::chrono::milliseconds quiet, std::function<void(T)> run,
+           SchedulerFunction scheduler = global_scheduler)
+      : state_(std::make_shared<State>(quiet, std::move(run),
+                                       std::move(scheduler))) {}
+
+  Debounce(const Debounce&) = delete;
+  auto operator=(const Debounce&) -> Debounce& = delete;
+
+  ~Debounce() {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stopped = true;
+  }
+
+  void push(T value) {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    if (state_->latest) {
+      ++state_->dropped;
+    }
+    state_->latest = std::move(value);
+    state_->last = Clock::now();
+    if (state_->armed) {
+      return;
+    }
+    state_->armed = true;
+    lock.unlock();
+    arm(state_, state_->quiet);
+  }
+
+  // Events replaced by a later one before the stage ran.
+  [[nodiscard]] auto dropped() const -> std::size_t {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->dropped;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct State {
+    std::mutex mutex;
+    std::chrono::milliseconds quiet;
+    std::function<void(T)> run;
+    SchedulerFunction scheduler;
+    std::optional<T> latest;
+    Clock::time_point last;
+    std::size_t dropped = 0;
+    bool armed = false;
+    bool stopped = false;
+    // Thread inside the scheduler call arming the timer, if any; the timer
+    // runs on it only when the scheduler runs tasks inline.
+    std::atomic<std::thread::id> arming{};
+
+    State(std::chrono::milliseconds q, std::function<void(T)> r,
+          SchedulerFunction s)
+        : quiet(q), run(std::move(r)), scheduler(std::move(s)) {}
+  };
+
+  std::shared_ptr<State> state_;
+
+  static void arm(const std::shared_ptr<State>& state,
+                  std::chrono::milliseconds delay) {
+    state->arming.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    state->scheduler(
+        [weak = std::weak_ptr<State>(state)] {
+          if (auto state = weak.lock()) {
+            fire(state);
+          }
+        },
+        static_cast<std::size_t>(delay.count()));
+    state->arming.store(std::thread::id(), std::memory_order_relaxed);
+  }
+
+  static void fire(const std::shared_ptr<State>& state) {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (state->stopped) {
+      return;
+    }
+    const auto quiet_until = state->last + state->quiet;
+    const auto now = Clock::now();
+    // Re-arming from an inline run would spin until the quiet period ends.
+    const bool inline_run =
+        state->arming.load(std::memory_order_relaxed) ==
+        std::this_thread::get_id();
+    if (now < quiet_until && !inline_run) {
+      lock.unlock();
+      // Rounded up so the re-armed timer does not fire early again.
+      arm(state, std::chrono::ceil<std::chrono::milliseconds>(quiet_until -
+                                                              now));
+      return;
+    }
+    T value = std::move(*state->latest);
+    state->latest.reset();
+    state->armed = false;
+    lock.unlock();
+    state->run(std::move(value));
+  }
+};
+
+// Runs at most once per `interval`. The first event of a burst runs at once
+// and opens the interval; events during it are held, the latest replacing
+// the others, and the held one runs when the interval ends and opens the
+// next. An interval that ends with nothing held closes the burst.
+template <typename T>
+class Throttle {
+ public:
+  Throttle(std::chrono::milliseconds interval, std::function<void(T)> run,
+           SchedulerFunction scheduler = global_scheduler)
+      : state_(std::make_shared<State>(interval, std::move(run),
+                                       std::move(scheduler))) {}
+
+  Throttle(const Throttle&) = delete;
+  auto operator=(const Throttle&) -> Throttle& = delete;
+
+  ~Throttle() {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->stopped = true;
+  }
+
+  void push(T value) {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    if (state_->open) {
+      if (state_->held) {
+        ++state_->dropped;
+      }
+      state_->held = std::move(value);
+      return;
+    }
+    state_->open = true;
+    lock.unlock();
+    arm(state_);
+    state_->run(std::move(value));
+  }
+
+  // Events replaced by a later one during an interval.
+  [[nodiscard]] auto dropped() const -> std::size_t {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->dropped;
+  }
+
+ private:
+  struct State {
+    std::mutex mutex;
+    std::chrono::milliseconds interval;
+    std::function<void(T)> run;
+    SchedulerFunction scheduler;
+    std::optional<T> held;
+    std::size_t dropped = 0;
+    bool open = false;
+    bool stopped = false;
+
+    State(std::chrono::milliseconds i, std::function<void(T)> r,
+          SchedulerFunction s)
+        : interval(i), run(std::move(r)), scheduler(std::move(s)) {}
+  };
+
+  std::shared_ptr<State> state_;
+
+  static void arm(const std::shared_ptr<State>& state) {
+    state->scheduler(
+        [weak = std::weak_ptr<State>(state)] {
+          if (auto state = weak.lock()) {
+            fire(state);
+          }
+        },
+        static_cast<std::size_t>(state->interval.count()));
+  }
+
+  static void fire(const std::shared_ptr<State>& state) {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (state->stopped) {
+      return;
+    }
+    if (!state->held) {
+      state->open = false;
+      return;
+    }
+    T value = std::move(*state->held);
+    state->held.reset();
+    lock.unlock();
+    arm(state);
+    state->run(std::move(value));
+  }
+};
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,577 @@
+#ifndef WORKSPACES_CPP20_EXECUTOR_HPP
+#define WORKSPACES_CPP20_EXECUTOR_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "topology.hpp"
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#include <ctime>
+#endif
+
+namespace async_chain {
+
+namespace detail {
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#else
+  std::this_thread::yield();
+#endif
+}
+
+// One-shot wakeup slot for a single parked thread. unpark() before park() is
+// not lost: the next park() returns immediately. Uses a futex on Linux and a
+// condition variable elsewhere.
+class Parker {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Returns when unparked or, if given, when `deadline` passes.
+  void park(const Clock::time_point* deadline) {
+#if defined(__linux__)
+    while (notified_.exchange(0, std::memory_order_acquire) == 0) {
+      timespec timeout{};
+      timespec* timeout_ptr = nullptr;
+      if (deadline != nullptr) {
+        const auto left = *deadline - Clock::now();
+        if (left <= Clock::duration::zero()) {
+          return;
+        }
+        const auto ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        timeout.tv_sec = static_cast<time_t>(ns / 1000000000);
+        timeout.tv_nsec = static_cast<long>(ns % 1000000000);
+        timeout_ptr = &timeout;
+      }
+      syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&notified_),
+              FUTEX_WAIT_PRIVATE, 0, timeout_ptr, nullptr, 0);
+    }
+#else
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto notified = [this] { return notified_.load() != 0; };
+    if (deadline != nullptr) {
+      cv_.wait_until(lock, *deadline, notified);
+    } else {
+      cv_.wait(lock, notified);
+    }
+    notified_.store(0);
+#endif
+  }
+
+  void unpark() {
+#if defined(__linux__)
+    notified_.store(1, std::memory_order_release);
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&notified_),
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      notified_.store(1);
+    }
+    cv_.notify_one();
+#endif
+  }
+
+ private:
+  std::atomic<std::uint32_t> notified_{0};
+#if !defined(__linux__)
+  std::mutex mutex_;
+  std::condition_variable cv_;
+#endif
+};
+
+// NUMA node of the executor worker running on this thread, -1 elsewhere.
+inline thread_local int current_worker_node = -1;
+
+}  // namespace detail
+
+using TenantId = std::uint32_t;
+
+inline constexpr TenantId kDefaultTenant = 0;
+
+// Per-tenant scheduling knobs. A zero limit means "unlimited".
+struct TenantQuota {
+  std::size_t weight = 1;         // DRR quantum: tasks served per round
+  std::size_t max_in_flight = 0;  // tasks running at the same time
+  double max_rate_per_sec = 0;    // token bucket refill rate
+  double burst = 1;               // token bucket capacity
+};
+
+// Snapshot of a tenant's counters. Latencies are in nanoseconds; queue
+// latency is measured from post() to task start.
+struct TenantStats {
+  TenantId tenant = kDefaultTenant;
+  std::uint64_t submitted = 0;
+  std::uint64_t completed = 0;
+  std::uint64_t queued = 0;
+  std::uint64_t in_flight = 0;
+  std::uint64_t total_queue_ns = 0;
+  std::uint64_t max_queue_ns = 0;
+  std::uint64_t total_run_ns = 0;
+  std::uint64_t max_run_ns = 0;
+};
+
+struct ExecutorOptions {
+  std::size_t threads = std::thread::hardware_concurrency();
+  // Upper bound for the idle spin window. The actual window follows the
+  // recent task inter-arrival time and is zero when tasks arrive slower than
+  // this; set it to zero to always park immediately.
+  std::chrono::nanoseconds max_spin = std::chrono::microseconds(50);
+  // Pin each worker to one CPU. Workers are spread round-robin over the NUMA
+  // nodes, and memory a pinned worker first touches is allocated on its own
+  // node by the kernel's default policy.
+  bool pin_workers = false;
+  // CPUs to pin to, in worker order; empty means every CPU the process may
+  // run on, as reported by cpuTopology().
+  std::vector<int> cpus;
+};
+
+// Thread pool that serves per-tenant FIFO queues with deficit round-robin.
+// Tenants only sit in the active ring while they have dispatchable work, so
+// picking the next task is amortized O(1) in the number of tenants.
+//
+// An idle worker spins briefly before parking, but only one worker spins at a
+// time; posters wake parked workers only for work the spinner cannot absorb.
+class Executor {
+ public:
+  using Task = std::function<void()>;
+
+  explicit Executor(
+      std::size_t num_threads = std::thread::hardware_concurrency())
+      : Executor(withThreads(num_threads)) {}
+
+  explicit Executor(ExecutorOptions options)
+      : max_spin_ns_(nanos(options.max_spin)),
+        arrival_gap_ns_(UINT64_MAX / 2) {
+    const auto count = std::max<std::size_t>(options.threads, 1);
+    workers_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      workers_.push_back(std::make_unique<Worker>());
+    }
+    if (options.pin_workers) {
+      placeWorkers(cpuTopology(), options.cpus);
+    }
+    for (auto& worker : workers_) {
+      Worker* w = worker.get();
+      w->thread = std::thread([this, w] { workerLoop(*w); });
+    }
+  }
+
+  Executor(const Executor&) = delete;
+  Executor(Executor&&) = delete;
+  auto operator=(const Executor&) -> Executor& = delete;
+  auto operator=(Executor&&) -> Executor& = delete;
+
+  // Runs every task that was already posted, then joins the workers.
+  ~Executor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      posts_.fetch_add(1, std::memory_order_relaxed);
+      unparkLocked(idle_.size());
+    }
+    for (auto& worker : workers_) {
+      worker->thread.join();
+    }
+  }
+
+  void setTenantQuota(TenantId tenant, TenantQuota quota) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = tenantLocked(tenant);
+    quota.weight = std::max<std::size_t>(quota.weight, 1);
+    quota.burst = std::max(quota.burst, 1.0);
+    state.quota = quota;
+    state.tokens = quota.burst;
+    state.refilled = Clock::now();
+  }
+
+  void post(Task task) { post(kDefaultTenant, std::move(task)); }
+
+  void post(TenantId tenant, Task task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto now = Clock::now();
+    auto& state = tenantLocked(tenant);
+    state.queue.push_back(Entry{std::move(task), now});
+    ++state.stats.submitted;
+    ++queued_;
+    activateLocked(state);
+    noteArrivalLocked(now, 1);
+  }
+
+  // Enqueues [first, last) under one lock acquisition and wakes at most one
+  // parked worker per task. Tasks are moved out of the range.
+  template <typename Iterator>
+  void postBatch(TenantId tenant, Iterator first, Iterator last) {
+    if (first == last) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = tenantLocked(tenant);
+    const auto now = Clock::now();
+    std::size_t count = 0;
+    for (; first != last; ++first, ++count) {
+      state.queue.push_back(Entry{std::move(*first), now});
+    }
+    state.stats.submitted += count;
+    queued_ += count;
+    activateLocked(state);
+    noteArrivalLocked(now, count);
+  }
+
+  template <typename Iterator>
+  void postBatch(Iterator first, Iterator last) {
+    postBatch(kDefaultTenant, first, last);
+  }
+
+  void postBatch(TenantId tenant, std::vector<Task>& tasks) {
+    postBatch(tenant, tasks.begin(), tasks.end());
+    tasks.clear();
+  }
+
+  void postBatch(std::vector<Task>& tasks) {
+    postBatch(kDefaultTenant, tasks);
+  }
+
+  [[nodiscard]] auto stats(TenantId tenant) const -> TenantStats {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tenants_.find(tenant);
+    if (it == tenants_.end()) {
+      TenantStats empty;
+      empty.tenant = tenant;
+      return empty;
+    }
+    return snapshotLocked(*it->second);
+  }
+
+  [[nodiscard]] auto allStats() const -> std::vector<TenantStats> {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<TenantStats> out;
+    out.reserve(tenants_.size());
+    for (const auto& [id, state] : tenants_) {
+      out.push_back(snapshotLocked(*state));
+    }
+    return out;
+  }
+
+  [[nodiscard]] auto threadCount() const -> std::size_t {
+    return workers_.size();
+  }
+
+  // Number of NUMA nodes the workers are spread over; 1 unless pinned.
+  [[nodiscard]] auto nodeCount() const -> std::size_t { return node_count_; }
+
+  // NUMA node of the calling executor worker, or -1 on any other thread. Lets
+  // tasks keep per-node pools and caches.
+  static auto currentNode() -> int { return detail::current_worker_node; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static auto withThreads(std::size_t num_threads) -> ExecutorOptions {
+    ExecutorOptions options;
+    options.threads = num_threads;
+    return options;
+  }
+
+  struct Entry {
+    Task task;
+    Clock::time_point enqueued;
+  };
+
+  struct TenantState {
+    TenantId id;
+    TenantQuota quota;
+    std::deque<Entry> queue;
+    std::size_t deficit = 0;
+    std::size_t in_flight = 0;
+    double tokens = 1;
+    Clock::time_point refilled = Clock::now();
+    bool in_ring = false;    // linked into active_
+    bool throttled = false;  // parked in throttled_ until tokens refill
+    TenantStats stats;
+  };
+
+  struct Worker {
+    std::thread thread;
+    detail::Parker parker;
+    int cpu = -1;  // pinned CPU, -1 when floating
+    int node = 0;
+    bool parked = false;  // listed in idle_
+  };
+
+  struct Throttled {
+    Clock::time_point ready;
+    TenantState* tenant;
+    auto operator>(const Throttled& other) const -> bool {
+      return ready > other.ready;
+    }
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<TenantId, std::unique_ptr<TenantState>> tenants_;
+  std::deque<TenantState*> active_;
+  std::priority_queue<Throttled, std::vector<Throttled>, std::greater<>>
+      throttled_;
+  std::size_t queued_ = 0;
+  bool stopping_ = false;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<Worker*> idle_;  // parked workers, most recent last
+  std::size_t node_count_ = 1;
+  bool spinning_ = false;      // at most one spinner at a time
+  std::atomic<std::uint64_t> posts_{0};  // bumped per post, polled by spinner
+  const std::uint64_t max_spin_ns_;
+  std::uint64_t arrival_gap_ns_;  // EWMA of the time between posts
+  Clock::time_point last_arrival_ = Clock::now();
+
+  // Records `count` new tasks: updates the arrival-rate estimate, pokes the
+  // spinner and unparks whoever the spinner cannot cover.
+  void noteArrivalLocked(Clock::time_point now, std::size_t count) {
+    const auto gap = nanos(now - last_arrival_) / count;
+    last_arrival_ = now;
+    arrival_gap_ns_ = arrival_gap_ns_ - arrival_gap_ns_ / 8 + gap / 8;
+    posts_.fetch_add(1, std::memory_order_release);
+    unparkLocked(spinning_ ? count - 1 : count);
+  }
+
+  void placeWorkers(const CpuTopology& topology,
+                    const std::vector<int>& cpus) {
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+      auto& worker = *workers_[i];
+      if (!cpus.empty()) {
+        worker.cpu = cpus[i % cpus.size()];
+        worker.node = static_cast<int>(topology.nodeOf(worker.cpu));
+      } else {
+        const auto node = i % topology.nodes.size();
+        const auto& node_cpus = topology.nodes[node];
+        worker.cpu = node_cpus[(i / topology.nodes.size()) % node_cpus.size()];
+        worker.node = static_cast<int>(node);
+      }
+    }
+    node_count_ = topology.nodes.size();
+  }
+
+  // Unparks up to `count` idle workers, preferring the poster's own node so
+  // follow-up work stays near the memory it was created in.
+  void unparkLocked(std::size_t count) {
+    const int node = detail::current_worker_node;
+    while (count-- > 0 && !idle_.empty()) {
+      auto it = std::prev(idle_.end());
+      if (node_count_ > 1 && node >= 0) {
+        auto local =
+            std::find_if(idle_.rbegin(), idle_.rend(),
+                         [node](Worker* w) { return w->node == node; });
+        if (local != idle_.rend()) {
+          it = std::prev(local.base());
+        }
+      }
+      Worker* worker = *it;
+      idle_.erase(it);
+      worker->parked = false;
+      worker->parker.unpark();
+    }
+  }
+
+  auto spinWindowLocked() const -> Clock::duration {
+    if (arrival_gap_ns_ > max_spin_ns_) {
+      return Clock::duration::zero();
+    }
+    return std::chrono::nanoseconds(
+        std::min(2 * arrival_gap_ns_, max_spin_ns_));
+  }
+
+  static auto nanos(Clock::duration d) -> std::uint64_t {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  }
+
+  auto tenantLocked(TenantId tenant) -> TenantState& {
+    auto& slot = tenants_[tenant];
+    if (!slot) {
+      slot = std::make_unique<TenantState>();
+      slot->id = tenant;
+      slot->stats.tenant = tenant;
+    }
+    return *slot;
+  }
+
+  static auto snapshotLocked(const TenantState& state) -> TenantStats {
+    TenantStats out = state.stats;
+    out.queued = state.queue.size();
+    out.in_flight = state.in_flight;
+    return out;
+  }
+
+  void activateLocked(TenantState& state) {
+    if (!state.in_ring && !state.throttled && !state.queue.empty() &&
+        !atInFlightLimit(state)) {
+      state.in_ring = true;
+      active_.push_back(&state);
+    }
+  }
+
+  static auto atInFlightLimit(const TenantState& state) -> bool {
+    return state.quota.max_in_flight != 0 &&
+           state.in_flight >= state.quota.max_in_flight;
+  }
+
+  // Refills the token bucket. Returns time_point::min() when a token is
+  // available now, otherwise the time the next token is due.
+  static auto refill(TenantState& state, Clock::time_point now)
+      -> Clock::time_point {
+    if (state.quota.max_rate_per_sec <= 0) {
+      return Clock::time_point::min();
+    }
+    const double elapsed =
+        std::chrono::duration<double>(now - state.refilled).count();
+    const double refilled = elapsed * state.quota.max_rate_per_sec;
+    state.tokens = std::min(state.quota.burst, state.tokens + refilled);
+    state.refilled = now;
+    if (state.tokens >= 1) {
+      return Clock::time_point::min();
+    }
+    const double wait_s = (1 - state.tokens) / state.quota.max_rate_per_sec;
+    return now + std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>(wait_s));
+  }
+
+  void releaseThrottledLocked(Clock::time_point now) {
+    while (!throttled_.empty() && throttled_.top().ready <= now) {
+      TenantState* state = throttled_.top().tenant;
+      throttled_.pop();
+      state->throttled = false;
+      activateLocked(*state);
+    }
+  }
+
+  // Every loop iteration either dispatches a task or unlinks a tenant that was
+  // linked by an earlier post/completion, hence amortized O(1).
+  auto pickLocked(Clock::time_point now, Entry& out) -> TenantState* {
+    releaseThrottledLocked(now);
+    while (!active_.empty()) {
+      TenantState* state = active_.front();
+      if (state->queue.empty() || atInFlightLimit(*state)) {
+        active_.pop_front();
+        state->in_ring = false;
+        state->deficit = 0;
+        continue;
+      }
+      const auto ready = refill(*state, now);
+      if (ready != Clock::time_point::min()) {
+        active_.pop_front();
+        state->in_ring = false;
+        state->deficit = 0;
+        state->throttled = true;
+        throttled_.push(Throttled{ready, state});
+        continue;
+      }
+      if (state->deficit == 0) {
+        state->deficit = state->quota.weight;
+      }
+      out = std::move(state->queue.front());
+      state->queue.pop_front();
+      --queued_;
+      --state->deficit;
+      if (state->quota.max_rate_per_sec > 0) {
+        state->tokens -= 1;
+      }
+      ++state->in_flight;
+      state->stats.total_queue_ns += nanos(now - out.enqueued);
+      state->stats.max_queue_ns =
+          std::max(state->stats.max_queue_ns, nanos(now - out.enqueued));
+      if (state->deficit == 0 || state->queue.empty()) {
+        active_.pop_front();
+        state->in_ring = false;
+        state->deficit = 0;
+        activateLocked(*state);
+      }
+      return state;
+    }
+    return nullptr;
+  }
+
+  void workerLoop(Worker& self) {
+    if (self.cpu >= 0) {
+      pinCurrentThread(self.cpu);
+    }
+    detail::current_worker_node = self.node;
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool spun = false;
+    for (;;) {
+      Entry entry;
+      TenantState* state = pickLocked(Clock::now(), entry);
+      if (state == nullptr) {
+        if (stopping_ && queued_ == 0) {
+          return;
+        }
+        const auto window = spinWindowLocked();
+        if (!spun && !spinning_ && window > Clock::duration::zero()) {
+          spinning_ = true;
+          const auto seen = posts_.load(std::memory_order_acquire);
+          lock.unlock();
+          const auto until = Clock::now() + window;
+          while (posts_.load(std::memory_order_acquire) == seen &&
+                 Clock::now() < until) {
+            detail::cpuRelax();
+          }
+          lock.lock();
+          spinning_ = false;
+          spun = posts_.load(std::memory_order_relaxed) == seen;
+          continue;
+        }
+        spun = false;
+        self.parked = true;
+        idle_.push_back(&self);
+        const bool timed = !throttled_.empty();
+        const auto deadline = timed ? throttled_.top().ready : Clock::now();
+        lock.unlock();
+        self.parker.park(timed ? &deadline : nullptr);
+        lock.lock();
+        if (self.parked) {
+          idle_.erase(std::find(idle_.begin(), idle_.end(), &self));
+          self.parked = false;
+        }
+        continue;
+      }
+      lock.unlock();
+      spun = false;
+      const auto started = Clock::now();
+      entry.task();
+      const auto run_ns = nanos(Clock::now() - started);
+      entry.task = nullptr;
+      lock.lock();
+      --state->in_flight;
+      ++state->stats.completed;
+      state->stats.total_run_ns += run_ns;
+      state->stats.max_run_ns = std::max(state->stats.max_run_ns, run_ns);
+      activateLocked(*state);
+    }
+  }
+};
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef WORKSPACES_CPP20_GENERATOR_HPP
+#define WORKSPACES_CPP20_GENERATOR_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async.hpp"
+
+namespace async_chain {
+
+// One item per call: the source calls `emit` once with the next item, or
+// with nullopt at the end of the stream. It is never called again before
+// emitting, so a cursor or file offset needs no locking.
+template <typename T, typename E = std::string>
+using GeneratorSource = std::function<void(
+    std::function<void(std::optional<Result<T, E>>)> emit)>;
+
+// Pull-based asynchronous sequence over a GeneratorSource. The source runs
+// only to answer pulls plus `readahead` items fetched ahead of them, so a
+// slow source overlaps with the consumer without the whole stream being
+// buffered. Items are delivered in source order; an error item is delivered
+// like any other and does not end the stream.
+//
+// A generator is also a chain step over std::optional<T>: each call pulls one
+// item and continues with it, with an empty optional at the end.
+//
+//   AsyncGenerator<Page> pages(fetchPage, 2);
+//   initAsyncChain<std::optional<Page>, std::string>()
+//       .then(pages)
+//       .then(process)
+//       .finally(done);
+template <typename T, typename E = std::string>
+class AsyncGenerator {
+ public:
+  using Item = std::optional<Result<T, E>>;
+
+  explicit AsyncGenerator(GeneratorSource<T, E> source,
+                          std::size_t readahead = 1)
+      : state_(std::make_shared<State>(std::move(source), readahead)) {}
+
+  // Calls `on_item` with the next item, or nullopt after the last one.
+  template <typename OnItem>
+  void next(OnItem&& on_item) const {
+    pull(state_, std::forward<OnItem>(on_item));
+  }
+
+  template <typename Next, typename Input>
+  void operator()(Next next_step, const Input& /*input*/) const {
+    using Out = Result<std::optional<T>, E>;
+    pull(state_, [next_step = std::move(next_step)](Item item) mutable {
+      if (!item) {
+        next_step(Out::Ok(std::nullopt));
+      } else if (item->is_err()) {
+        next_step(Out::Err(std::move(*item->error)));
+      } else {
+        next_step(Out::Ok(std::move(*item->value)));
+      }
+    });
+  }
+
+  // Runs `process(item, done)` for every item with at most `max_in_flight`
+  // unfinished, pulling the next item only when one finishes, then calls
+  // `on_end` once the stream ended and every item is done. Items that are
+  // processed synchronously are looped over rather than nested.
+  template <typename Process, typename OnEnd>
+  void forEach(Process process, std::size_t max_in_flight,
+               OnEnd on_end) const {
+    const auto slots = std::max<std::size_t>(max_in_flight, 1);
+    auto drain = std::make_shared<Drain<Process, OnEnd>>(
+        state_, std::move(process), std::move(on_end), slots);
+    for (std::size_t i = 0; i < slots; ++i) {
+      pullInto(drain);
+    }
+  }
+
+  // Items fetched and not yet pulled.
+  [[nodiscard]] auto buffered() const -> std::size_t {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->buffer.size();
+  }
+
+ private:
+  struct State {
+    std::mutex mutex;
+    GeneratorSource<T, E> source;
+    std::size_t readahead;
+    std::deque<Result<T, E>> buffer;
+    std::deque<std::function<void(Item)>> waiters;
+    bool fetching = false;
+    bool ended = false;
+
+    State(GeneratorSource<T, E> src, std::size_t ahead)
+        : source(std::move(src)), readahead(ahead) {}
+  };
+
+  template <typename Process, typename OnEnd>
+  struct Drain {
+    std::shared_ptr<State> state;
+    Process process;
+    OnEnd on_end;
+    std::atomic<std::size_t> slots;
+
+    Drain(std::shared_ptr<State> s, Process p, OnEnd e, std::size_t n)
+        : state(std::move(s)),
+          process(std::move(p)),
+          on_end(std::move(e)),
+          slots(n) {}
+  };
+
+  std::shared_ptr<State> state_;
+
+  template <typename OnItem>
+  static void pull(const std::shared_ptr<State>& state, OnItem&& on_item) {
+    if (auto item = tryTake(state)) {
+      on_item(std::move(*item));
+      return;
+    }
+    std::unique_lock<std::mutex> lock(state->mutex);
+    // An item or the end may have arrived since tryTake() looked.
+    if (!state->buffer.empty() || state->ended) {
+      lock.unlock();
+      pull(state, std::forward<OnItem>(on_item));
+      return;
+    }
+    state->waiters.emplace_back(std::forward<OnItem>(on_item));
+    lock.unlock();
+    fetch(state);
+  }
+
+  // The next item if it is buffered, or can be fetched synchronously, or the
+  // stream has ended; nullopt when it has to be waited for.
+  static auto tryTake(const std::shared_ptr<State>& state)
+      -> std::optional<Item> {
+    for (bool fetched = false;; fetched = true) {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      if (!state->buffer.empty()) {
+        Item item(std::move(state->buffer.front()));
+        state->buffer.pop_front();
+        lock.unlock();
+        fetch(state);
+        return item;
+      }
+      if (state->ended) {
+        return Item{};
+      }
+      if (fetched || !state->waiters.empty()) {
+        return std::nullopt;
+      }
+      lock.unlock();
+      fetch(state, true);
+    }
+  }
+
+  // Starts one source call when a pull is waiting, `demand` is set or the
+  // readahead is not full; the emit callback starts the next.
+  static void fetch(const std::shared_ptr<State>& state, bool demand = false) {
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->fetching || state->ended ||
+          (!demand && state->waiters.empty() &&
+           state->buffer.size() >= state->readahead)) {
+        return;
+      }
+      state->fetching = true;
+    }
+    state->source([state](Item item) {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      state->fetching = false;
+      if (!item) {
+        state->ended = true;
+        auto waiters = std::move(state->waiters);
+        state->waiters.clear();
+        lock.unlock();
+        for (auto& waiter : waiters) {
+          waiter(Item{});
+        }
+        return;
+      }
+      if (state->waiters.empty()) {
+        state->buffer.push_back(std::move(*item));
+        lock.unlock();
+      } else {
+        auto waiter = std::move(state->waiters.front());
+        state->waiters.pop_front();
+        lock.unlock();
+        waiter(std::move(item));
+      }
+      fetch(state);
+    });
+  }
+
+  template <typename DrainPtr>
+  static void pullInto(const DrainPtr& drain) {
+    pull(drain->state,
+         [drain](Item item) { deliver(drain, std::move(item)); });
+  }
+
+  // `turn` tells a `done` called during process() (1) from a later one
+  // (2 already set): the first continues this loop, the second pulls anew.
+  template <typename DrainPtr>
+  static void deliver(const DrainPtr& drain, Item item) {
+    for (;;) {
+      if (!item) {
+        if (drain->slots.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          drain->on_end();
+        }
+        return;
+      }
+      auto turn = std::make_shared<std::atomic<int>>(0);
+      drain->process(std::move(*item), [drain, turn] {
+        if (turn->exchange(1, std::memory_order_acq_rel) == 2) {
+          pullInto(drain);
+        }
+      });
+      if (turn->exchange(2, std::memory_order_acq_rel) == 0) {
+        return;
+      }
+      auto next = tryTake(drain->state);
+      if (!next) {
+        pullInto(drain);
+        return;
+      }
+      item = std::move(*next);
+    }
+  }
+};
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef WORKSPACES_CPP20_POOL_HPP
+#define WORKSPACES_CPP20_POOL_HPP
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "async.hpp"
+#include "thread_slot.hpp"
+
+namespace async_chain {
+
+// Pool of up to `capacity` expensive objects (connections, parser contexts,
+// scratch buffers), created on demand by `create`. acquire() never blocks a
+// thread: when every object is leased, the callback is queued and runs on the
+// thread that returns the next one.
+//
+// Returned objects go to a small cache of the returning thread, which the
+// same thread's next acquire() takes from under a lock no other thread
+// touches in the common case. An acquire that finds the pool empty takes
+// objects idle in other threads' caches before it waits, so none is
+// stranded there while callbacks are queued.
+//
+//   AsyncPool<Connection> connections(connect, 16);
+//   auto query = connections.with([](Connection& db, auto next, auto in) {
+//     db.query(*in.value, next);
+//   });
+//   initAsyncChain<Request, std::string>().then(query).finally(done);
+template <typename T>
+class AsyncPool {
+  struct State;
+
+ public:
+  // Returns its object to the pool when destroyed or reset, including when
+  // a chain holding it is dropped without running on.
+  class Lease {
+   public:
+    Lease() = default;
+    Lease(Lease&&) noexcept = default;
+    auto operator=(Lease&& other) noexcept -> Lease& {
+      reset();
+      state_ = std::move(other.state_);
+      object_ = std::move(other.object_);
+      return *this;
+    }
+    ~Lease() { reset(); }
+
+    auto operator*() const -> T& { return *object_; }
+    auto operator->() const -> T* { return object_.get(); }
+    explicit operator bool() const { return object_ != nullptr; }
+
+    void reset() {
+      if (object_) {
+        State::release(state_, std::move(object_));
+        state_.reset();
+      }
+    }
+
+   private:
+    friend class AsyncPool;
+
+    Lease(std::shared_ptr<State> state, std::unique_ptr<T> object)
+        : state_(std::move(state)), object_(std::move(object)) {}
+
+    std::shared_ptr<State> state_;
+    std::unique_ptr<T> object_;
+  };
+
+  AsyncPool(std::function<std::unique_ptr<T>()> create, std::size_t capacity,
+            std::size_t cache_per_thread = 4)
+      : state_(std::make_shared<State>(std::move(create), capacity,
+                                       cache_per_thread)) {}
+
+  // Calls `on_lease(Lease)` with a free object, now or once one is returned.
+  // Throws what `create` throws, or std::logic_error if it returns null.
+  template <typename OnLease>
+  void acquire(OnLease&& on_lease) const {
+    if (auto object = state_->takeCached()) {
+      on_lease(Lease(state_, std::move(object)));
+      return;
+    }
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    auto object = state_->takeShared(lock);
+    if (!object) {
+      // Weak, so a pool dropped with callbacks queued is still freed; the
+      // releasing lease keeps the state alive while a waiter runs.
+      state_->waiters.emplace_back(
+          [weak = std::weak_ptr<State>(state_),
+           on_lease = std::forward<OnLease>(on_lease)](
+              std::unique_ptr<T> object) mutable {
+            on_lease(Lease(weak.lock(), std::move(object)));
+          });
+      return;
+    }
+    lock.unlock();
+    on_lease(Lease(state_, std::move(object)));
+  }
+
+  // Chain step calling `step(object, next, input)` with a leased object,
+  // which is returned when the step continues the chain.
+  template <typename Step>
+  class WithStep {
+   public:
+    template <typename Next, typename Input>
+    void operator()(Next next, Input input) {
+      pool_->acquire([step = &step_, next = std::move(next),
+                      input = std::move(input)](Lease lease) mutable {
+        auto held = std::make_shared<Lease>(std::move(lease));
+        auto& object = **held;
+        (*step)(
+            object,
+            [next = std::move(next), held](auto result) mutable {
+              held->reset();
+              next(std::move(result));
+            },
+            std::move(input));
+      });
+    }
+
+   private:
+    friend class AsyncPool;
+
+    WithStep(const AsyncPool* pool, Step step)
+        : pool_(pool), step_(std::move(step)) {}
+
+    const AsyncPool* pool_;
+    Step step_;
+  };
+
+  // Like chain steps, the returned step must be kept as an lvalue and must
+  // not outlive the pool.
+  template <typename Step>
+  [[nodiscard]] auto with(Step step) const -> WithStep<Step> {
+    return WithStep<Step>(this, std::move(step));
+  }
+
+  // Objects created so far, leased ones included.
+  [[nodiscard]] auto size() const -> std::size_t {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->created;
+  }
+
+  [[nodiscard]] auto leased() const -> std::size_t {
+    return state_->leased.load(std::memory_order_relaxed);
+  }
+
+  // Acquire callbacks queued for an object.
+  [[nodiscard]] auto waiting() const -> std::size_t {
+    return state_->waiting.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Cache {
+    Cache* next = nullptr;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<T>> idle;
+  };
+
+  using Waiter = std::function<void(std::unique_ptr<T>)>;
+
+  struct State {
+    std::function<std::unique_ptr<T>()> create;
+    std::size_t capacity;
+    std::size_t cache_per_thread;
+    detail::ThreadSlotKey cache_key;
+    std::atomic<Cache*> caches{nullptr};
+    std::atomic<std::size_t> leased{0};
+    // Incremented before an acquire scans the caches and decremented when
+    // it is served, so a release that caches an object sees it or is seen.
+    std::atomic<std::size_t> waiting{0};
+    std::mutex mutex;
+    std::size_t created = 0;
+    std::vector<std::unique_ptr<T>> idle;
+    std::deque<Waiter> waiters;
+
+    State(std::function<std::unique_ptr<T>()> c, std::size_t cap,
+          std::size_t per_thread)
+        : create(std::move(c)), capacity(cap), cache_per_thread(per_thread) {}
+
+    State(const State&) = delete;
+    auto operator=(const State&) -> State& = delete;
+
+    ~State() {
+      for (auto* cache = caches.load(); cache != nullptr;) {
+        delete std::exchange(cache, cache->next);
+      }
+    }
+
+    auto localCache() -> Cache& {
+      auto& slot = detail::threadSlot(cache_key);
+      if (slot == nullptr) {
+        auto* cache = new Cache;
+        cache->next = caches.load(std::memory_order_relaxed);
+        while (!caches.compare_exchange_weak(cache->next, cache)) {
+        }
+        slot = cache;
+      }
+      return *static_cast<Cache*>(slot);
+    }
+
+    auto takeCached() -> std::unique_ptr<T> {
+      auto& cache = localCache();
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      if (cache.idle.empty()) {
+        return nullptr;
+      }
+      auto object = std::move(cache.idle.back());
+      cache.idle.pop_back();
+      leased.fetch_add(1, std::memory_order_relaxed);
+      return object;
+    }
+
+    // Under `mutex`: an idle object, a new one if below capacity, or one
+    // taken from another thread's cache. Null means the caller must wait,
+    // and `waiting` then counts it. Creating drops the lock; a create that
+    // throws or returns null gives its capacity back and throws.
+    auto takeShared(std::unique_lock<std::mutex>& lock)
+        -> std::unique_ptr<T> {
+      std::unique_ptr<T> object;
+      if (!idle.empty()) {
+        object = std::move(idle.back());
+        idle.pop_back();
+      } else if (created < capacity) {
+        ++created;
+        lock.unlock();
+        try {
+          object = create();
+          if (!object) {
+            throw std::logic_error("AsyncPool: create returned null");
+          }
+        } catch (...) {
+          lock.lock();
+          --created;
+          throw;
+        }
+        lock.lock();
+      } else {
+        waiting.fetch_add(1, std::memory_order_seq_cst);
+        object = steal();
+        if (!object) {
+          return nullptr;
+        }
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+      }
+      leased.fetch_add(1, std::memory_order_relaxed);
+      return object;
+    }
+
+    auto steal() -> std::unique_ptr<T> {
+      for (auto* cache = caches.load(std::memory_order_seq_cst);
+           cache != nullptr; cache = cache->next) {
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        if (!cache->idle.empty()) {
+          auto object = std::move(cache->idle.back());
+          cache->idle.pop_back();
+          return object;
+        }
+      }
+      return nullptr;
+    }
+
+    static void release(const std::shared_ptr<State>& state,
+                        std::unique_ptr<T> object) {
+      state->leased.fetch_sub(1, std::memory_order_relaxed);
+      if (state->waiting.load(std::memory_order_seq_cst) == 0) {
+        auto& cache = state->localCache();
+        std::unique_lock<std::mutex> lock(cache.mutex);
+        if (cache.idle.size() < state->cache_per_thread) {
+          cache.idle.push_back(std::move(object));
+          lock.unlock();
+          if (state->waiting.load(std::memory_order_seq_cst) == 0) {
+            return;
+          }
+          // A waiter queued meanwhile; hand it an object unless it already
+          // took this one.
+          object = state->steal();
+          if (!object) {
+            return;
+          }
+        }
+      }
+      std::unique_lock<std::mutex> lock(state->mutex);
+      if (state->waiters.empty()) {
+        state->idle.push_back(std::move(object));
+        return;
+      }
+      auto waiter = std::move(state->waiters.front());
+      state->waiters.pop_front();
+      state->waiting.fetch_sub(1, std::memory_order_relaxed);
+      state->leased.fetch_add(1, std::memory_order_relaxed);
+      lock.unlock();
+      serve(std::move(waiter), std::move(object));
+    }
+
+    // A waiter that returns its object while being served would serve the
+    // next one inside its own call, and a long queue would overflow the
+    // stack. Hand-offs made during one are queued and run by the outermost.
+    static void serve(Waiter waiter, std::unique_ptr<T> object) {
+      using Pending = std::deque<std::pair<Waiter, std::unique_ptr<T>>>;
+      thread_local Pending* pending = nullptr;
+      if (pending != nullptr) {
+        pending->emplace_back(std::move(waiter), std::move(object));
+        return;
+      }
+      Pending queue;
+      pending = &queue;
+      struct Reset {
+        Pending*& pending;
+        ~Reset() { pending = nullptr; }
+      } reset{pending};
+      waiter(std::move(object));
+      while (!queue.empty()) {
+        auto next = std::move(queue.front());
+        queue.pop_front();
+        next.first(std::move(next.second));
+      }
+    }
+  };
+
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace async_chain
+
+#endif
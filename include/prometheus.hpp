@@ -0,0 +1,383 @@
+#ifndef WORKSPACES_CPP20_PROMETHEUS_HPP
+#define WORKSPACES_CPP20_PROMETHEUS_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "stats.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace async_chain {
+
+namespace detail {
+
+inline void appendLine(std::string& out, const char* format, ...) {
+  char line[512];
+  va_list args;
+  va_start(args, format);
+  const int n = std::vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (n > 0) {
+    out.append(line, std::min<std::size_t>(static_cast<std::size_t>(n),
+                                           sizeof(line) - 1));
+  }
+}
+
+inline void appendMetricHeader(std::string& out, const char* name,
+                               const char* type, const char* help) {
+  appendLine(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Prometheus metric names allow [a-zA-Z0-9_:]; everything else becomes '_'.
+inline auto metricName(const char* raw) -> std::string {
+  std::string name = raw;
+  for (auto& c : name) {
+    const bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                    (c >= '0' && c <= '9') || c == '_' || c == ':';
+    c = ok ? c : '_';
+  }
+  return name;
+}
+
+// Label values escape backslash, quote and newline.
+inline auto labelValue(const char* raw) -> std::string {
+  std::string value;
+  for (const char* c = raw; *c != '\0'; ++c) {
+    if (*c == '\\' || *c == '"') {
+      value += '\\';
+      value += *c;
+    } else if (*c == '\n') {
+      value += "\\n";
+    } else {
+      value += *c;
+    }
+  }
+  return value;
+}
+
+// One histogram series from log2 ns buckets, as cumulative seconds buckets.
+using LatencyBuckets = std::uint64_t[kStatsLatencyBuckets];
+
+inline void appendHistogram(std::string& out, const char* name,
+                            const std::string& labels,
+                            const LatencyBuckets& buckets,
+                            std::uint64_t sum_ns) {
+  std::uint64_t cumulative = 0;
+  for (std::size_t b = 0; b < kStatsLatencyBuckets; ++b) {
+    cumulative += buckets[b];
+    appendLine(out, "%s_bucket{%sle=\"%.9g\"} %llu\n", name, labels.c_str(),
+               static_cast<double>(std::uint64_t{1} << b) / 1e9,
+               static_cast<unsigned long long>(cumulative));
+  }
+  appendLine(out, "%s_bucket{%sle=\"+Inf\"} %llu\n", name, labels.c_str(),
+             static_cast<unsigned long long>(cumulative));
+  const auto bare = labels.empty() ? std::string()
+                                   : "{" + labels.substr(0, labels.size() - 1) +
+                                         "}";
+  appendLine(out, "%s_sum%s %.9g\n", name, bare.c_str(),
+             static_cast<double>(sum_ns) / 1e9);
+  appendLine(out, "%s_count%s %llu\n", name, bare.c_str(),
+             static_cast<unsigned long long>(cumulative));
+}
+
+inline auto histogramTotal(const LatencyBuckets& buckets) -> std::uint64_t {
+  std::uint64_t total = 0;
+  for (auto count : buckets) {
+    total += count;
+  }
+  return total;
+}
+
+}  // namespace detail
+
+// Prometheus text exposition format (version 0.0.4) of one snapshot. Steps
+// and plans that never ran are left out.
+inline auto renderPrometheus(const StatsData& stats) -> std::string {
+  using detail::appendLine;
+  using detail::appendMetricHeader;
+  using ull = unsigned long long;
+  std::string out;
+
+  appendMetricHeader(out, "async_chain_chains_started_total", "counter",
+                     "Chains started.");
+  appendLine(out, "async_chain_chains_started_total %llu\n",
+             static_cast<ull>(stats.chains_started));
+  appendMetricHeader(out, "async_chain_chains_completed_total", "counter",
+                     "Chains whose final callback ran.");
+  appendLine(out, "async_chain_chains_completed_total %llu\n",
+             static_cast<ull>(stats.chains_completed));
+  appendMetricHeader(out, "async_chain_chains_in_flight", "gauge",
+                     "Chains started and not yet completed.");
+  appendLine(out, "async_chain_chains_in_flight %llu\n",
+             static_cast<ull>(stats.inFlight()));
+  appendMetricHeader(out, "async_chain_frame_bytes", "gauge",
+                     "Continuation frame bytes of chains in flight.");
+  appendLine(out, "async_chain_frame_bytes %llu\n",
+             static_cast<ull>(stats.live_frame_bytes));
+  appendMetricHeader(out, "async_chain_frame_bytes_peak", "gauge",
+                     "Highest frame bytes in flight seen by a collection.");
+  appendLine(out, "async_chain_frame_bytes_peak %llu\n",
+             static_cast<ull>(stats.peak_live_frame_bytes));
+
+  appendMetricHeader(out, "async_chain_errors_total", "counter",
+                     "Chains that completed with an error, by error code.");
+  for (std::size_t i = 0; i < stats.error_code_count; ++i) {
+    const auto code = stats.error_codes[i].code;
+    if (code == kStatsUnclassifiedError) {
+      appendLine(out, "async_chain_errors_total{code=\"unclassified\"} %llu\n",
+                 static_cast<ull>(stats.error_codes[i].count));
+    } else {
+      appendLine(out, "async_chain_errors_total{code=\"%lld\"} %llu\n",
+                 static_cast<long long>(code),
+                 static_cast<ull>(stats.error_codes[i].count));
+    }
+  }
+  if (stats.errors_other != 0) {
+    appendLine(out, "async_chain_errors_total{code=\"other\"} %llu\n",
+               static_cast<ull>(stats.errors_other));
+  }
+
+  appendMetricHeader(out, "async_chain_retries_total", "counter",
+                     "Step retries, by attempt number.");
+  for (std::size_t a = 1; a < kStatsMaxAttempts; ++a) {
+    if (stats.retries[a] != 0) {
+      appendLine(out, "async_chain_retries_total{attempt=\"%zu\"} %llu\n", a,
+                 static_cast<ull>(stats.retries[a]));
+    }
+  }
+  appendMetricHeader(out, "async_chain_speculations_total", "counter",
+                     "thenSpeculative steps, by outcome.");
+  constexpr const char* kOutcomes[kStatsSpeculationOutcomes] = {
+      "committed", "rerun", "discarded"};
+  for (std::size_t o = 0; o < kStatsSpeculationOutcomes; ++o) {
+    appendLine(out, "async_chain_speculations_total{outcome=\"%s\"} %llu\n",
+               kOutcomes[o], static_cast<ull>(stats.speculations[o]));
+  }
+  appendMetricHeader(out, "async_chain_timeouts_total", "counter",
+                     "Steps abandoned after a deadline.");
+  appendLine(out, "async_chain_timeouts_total %llu\n",
+             static_cast<ull>(stats.timeouts));
+  appendMetricHeader(out, "async_chain_cancellations_total", "counter",
+                     "Pending timers and steps cancelled.");
+  appendLine(out, "async_chain_cancellations_total %llu\n",
+             static_cast<ull>(stats.cancellations));
+
+  appendMetricHeader(out, "async_chain_step_duration_seconds", "histogram",
+                     "Step wall time, by plan and step index.");
+  for (std::size_t p = 0; p < stats.plan_count; ++p) {
+    const auto plan = detail::labelValue(stats.plan_names[p]);
+    for (std::size_t s = 0; s < stats.plan_step_rows[p]; ++s) {
+      const auto row = stats.stepRow(p, s);
+      if (detail::histogramTotal(stats.step_latency[row]) != 0) {
+        detail::appendHistogram(
+            out, "async_chain_step_duration_seconds",
+            "plan=\"" + plan + "\",step=\"" + std::to_string(s) + "\",",
+            stats.step_latency[row], stats.step_latency_sum_ns[row]);
+      }
+    }
+  }
+  constexpr auto kSharedRow = kStatsMaxStepRows - 1;
+  if (detail::histogramTotal(stats.step_latency[kSharedRow]) != 0) {
+    detail::appendHistogram(out, "async_chain_step_duration_seconds",
+                            "plan=\"other\",step=\"other\",",
+                            stats.step_latency[kSharedRow],
+                            stats.step_latency_sum_ns[kSharedRow]);
+  }
+  appendMetricHeader(out, "async_chain_plan_duration_seconds", "histogram",
+                     "Chain wall time from finally() to the final callback, "
+                     "by plan.");
+  for (std::size_t p = 0; p < stats.plan_count; ++p) {
+    if (detail::histogramTotal(stats.plan_latency[p]) != 0) {
+      detail::appendHistogram(
+          out, "async_chain_plan_duration_seconds",
+          "plan=\"" + detail::labelValue(stats.plan_names[p]) + "\",",
+          stats.plan_latency[p], stats.plan_latency_sum_ns[p]);
+    }
+  }
+  appendMetricHeader(out, "async_chain_plan_failures_total", "counter",
+                     "Chains that completed with an error, by plan.");
+  for (std::size_t p = 0; p < stats.plan_count; ++p) {
+    if (stats.plan_failed[p] != 0) {
+      appendLine(out, "async_chain_plan_failures_total{plan=\"%s\"} %llu\n",
+                 detail::labelValue(stats.plan_names[p]).c_str(),
+                 static_cast<ull>(stats.plan_failed[p]));
+    }
+  }
+
+  for (std::size_t g = 0; g < stats.gauge_count; ++g) {
+    const auto name =
+        "async_chain_" + detail::metricName(stats.gauges[g].name);
+    appendMetricHeader(out, name.c_str(), "gauge", "Registered gauge.");
+    appendLine(out, "%s %llu\n", name.c_str(),
+               static_cast<ull>(stats.gauges[g].value));
+  }
+  return out;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+enum class PrometheusOutput {
+  // Rewritten atomically every interval, e.g. for node_exporter's textfile
+  // collector.
+  kFile,
+  // Each connection receives the current snapshot; a request starting with
+  // "GET" gets an HTTP/1.0 response around it.
+  kUnixSocket,
+};
+
+// Renders collectStats() on its own thread; recording threads are never
+// involved.
+class PrometheusExporter {
+ public:
+  PrometheusExporter(
+      PrometheusOutput output, std::string path,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(1000))
+      : output_(output), path_(std::move(path)), interval_(interval) {
+    if (output_ == PrometheusOutput::kUnixSocket) {
+      listen_fd_ = listenOn(path_);
+    }
+    thread_ = std::thread([this] { run(); });
+  }
+
+  PrometheusExporter(const PrometheusExporter&) = delete;
+  auto operator=(const PrometheusExporter&) -> PrometheusExporter& = delete;
+
+  ~PrometheusExporter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    if (listen_fd_ >= 0) {
+      ::close(listen_fd_);
+      ::unlink(path_.c_str());
+    } else {
+      writeFile();
+    }
+  }
+
+  // Writes the file now; false if it could not be replaced.
+  auto writeFile() -> bool {
+    const auto tmp = path_ + ".tmp";
+    {
+      std::ofstream file(tmp, std::ios::trunc);
+      file << renderPrometheus(collectStats());
+      if (!file) {
+        return false;
+      }
+    }
+    return std::rename(tmp.c_str(), path_.c_str()) == 0;
+  }
+
+ private:
+  PrometheusOutput output_;
+  std::string path_;
+  std::chrono::milliseconds interval_;
+  int listen_fd_ = -1;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::thread thread_;
+
+  static auto listenOn(const std::string& path) -> int {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+      throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(path.c_str());
+    if (fd < 0 ||
+        ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) !=
+            0 ||
+        ::listen(fd, 16) != 0) {
+      const int error = errno;
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    return fd;
+  }
+
+  auto stopping() -> bool {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stopping_;
+  }
+
+  void serve(int client) {
+    // Scrapers send a request first; plain readers may send nothing.
+    char request[1024];
+    pollfd readable{client, POLLIN, 0};
+    ssize_t got = 0;
+    if (::poll(&readable, 1, 100) > 0) {
+      got = ::recv(client, request, sizeof(request), 0);
+    }
+    std::string response;
+    const auto body = renderPrometheus(collectStats());
+    if (got >= 3 && std::memcmp(request, "GET", 3) == 0) {
+      response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4"
+                 "\r\nContent-Length: " +
+                 std::to_string(body.size()) + "\r\n\r\n";
+    }
+    response += body;
+    for (std::size_t sent = 0; sent < response.size();) {
+      const auto n = ::send(client, response.data() + sent,
+                            response.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      sent += static_cast<std::size_t>(n);
+    }
+    ::close(client);
+  }
+
+  void run() {
+    if (output_ == PrometheusOutput::kFile) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!wake_.wait_for(lock, interval_, [this] { return stopping_; })) {
+        lock.unlock();
+        writeFile();
+        lock.lock();
+      }
+      return;
+    }
+    while (!stopping()) {
+      pollfd pending{listen_fd_, POLLIN, 0};
+      if (::poll(&pending, 1, 50) > 0) {
+        const int client = ::accept(listen_fd_, nullptr, nullptr);
+        if (client >= 0) {
+          serve(client);
+        }
+      }
+    }
+  }
+};
+
+#endif
+
+}  // namespace async_chain
+
+#endif
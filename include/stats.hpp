@@ -0,0 +1,669 @@
+#ifndef WORKSPACES_CPP20_STATS_HPP
+#define WORKSPACES_CPP20_STATS_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Runtime counters are compiled in only with -DASYNC_CHAIN_STATS=1, for the
+// same reason as step timing: any per-step branch stops short chains from
+// being flattened.
+#if !defined(ASYNC_CHAIN_STATS)
+#define ASYNC_CHAIN_STATS 0
+#endif
+
+namespace async_chain {
+
+inline constexpr bool kStatsBuilt = ASYNC_CHAIN_STATS != 0;
+
+// Step latency rows, one per step of each plan in registration order. Steps
+// of plans registered after the rows ran out share the last row.
+inline constexpr std::size_t kStatsMaxStepRows = 128;
+// Bucket b counts latencies in [2^(b-1), 2^b) ns; bucket 0 is < 1 ns.
+inline constexpr std::size_t kStatsLatencyBuckets = 48;
+// Retries by attempt number; later attempts share the last slot.
+inline constexpr std::size_t kStatsMaxAttempts = 16;
+// thenSpeculative outcomes: committed, rerun, discarded.
+inline constexpr std::size_t kStatsSpeculationOutcomes = 3;
+// Plans past the limit share the last slot.
+inline constexpr std::size_t kStatsMaxPlans = 64;
+inline constexpr std::size_t kStatsPlanNameSize = 64;
+// Distinct error codes per thread; others are counted as `errors_other`.
+inline constexpr std::size_t kStatsMaxErrorCodes = 32;
+inline constexpr std::size_t kStatsMaxGauges = 32;
+inline constexpr std::size_t kStatsGaugeNameSize = 48;
+
+// Code of errors of a type StatsErrorCode has no mapping for; exported as
+// code="unclassified".
+inline constexpr std::int64_t kStatsUnclassifiedError = -1;
+
+// Code a string error is counted under: its FNV-1a hash, made non-negative
+// so it never collides with kStatsUnclassifiedError.
+constexpr auto statsErrorCode(std::string_view message) -> std::int64_t {
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char c : message) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+  }
+  return static_cast<std::int64_t>(hash >> 1);
+}
+
+// Maps a chain's error to the code it is counted under. Integral and enum
+// errors are their own code and strings are hashed with statsErrorCode();
+// specialize for other error types.
+template <typename E, typename = void>
+struct StatsErrorCode {
+  static auto of(const E& /*error*/) -> std::int64_t {
+    return kStatsUnclassifiedError;
+  }
+};
+
+template <typename E>
+struct StatsErrorCode<
+    E, std::enable_if_t<std::is_integral_v<E> || std::is_enum_v<E>>> {
+  static auto of(const E& error) -> std::int64_t {
+    return static_cast<std::int64_t>(error);
+  }
+};
+
+template <typename E>
+struct StatsErrorCode<
+    E, std::enable_if_t<std::is_convertible_v<const E&, std::string_view>>> {
+  static auto of(const E& error) -> std::int64_t {
+    return statsErrorCode(error);
+  }
+};
+
+struct StatsGauge {
+  char name[kStatsGaugeNameSize];
+  std::uint64_t value;
+};
+
+struct StatsErrorCount {
+  std::int64_t code;
+  std::uint64_t count;
+};
+
+// Aggregated counters. Trivially copyable: this is also the payload of the
+// shared-memory segment.
+struct StatsData {
+  std::uint64_t published_unix_ns;
+  std::uint64_t chains_started;
+  std::uint64_t chains_completed;
+  std::uint64_t chains_failed;
+  std::uint64_t timeouts;
+  std::uint64_t cancellations;
+  // Continuation frames of chains in flight, see AsyncChain::frameBytes().
+  // The peak is the highest value any collectStats() call has seen.
+  std::uint64_t live_frame_bytes;
+  std::uint64_t peak_live_frame_bytes;
+  std::uint64_t retries[kStatsMaxAttempts];
+  std::uint64_t speculations[kStatsSpeculationOutcomes];
+  std::uint64_t step_latency[kStatsMaxStepRows][kStatsLatencyBuckets];
+  std::uint64_t step_latency_sum_ns[kStatsMaxStepRows];
+  std::uint64_t plan_count;
+  char plan_names[kStatsMaxPlans][kStatsPlanNameSize];
+  // First step_latency row of each plan and how many it has; zero rows
+  // means its steps are in the shared last row.
+  std::uint64_t plan_first_step_row[kStatsMaxPlans];
+  std::uint64_t plan_step_rows[kStatsMaxPlans];
+  std::uint64_t plan_failed[kStatsMaxPlans];
+  std::uint64_t plan_latency[kStatsMaxPlans][kStatsLatencyBuckets];
+  std::uint64_t plan_latency_sum_ns[kStatsMaxPlans];
+  std::uint64_t error_code_count;
+  StatsErrorCount error_codes[kStatsMaxErrorCodes];
+  std::uint64_t errors_other;
+  std::uint64_t gauge_count;
+  StatsGauge gauges[kStatsMaxGauges];
+
+  [[nodiscard]] auto inFlight() const -> std::uint64_t {
+    return chains_started - std::min(chains_started, chains_completed);
+  }
+
+  // step_latency row of step `step` of plan `plan`.
+  [[nodiscard]] auto stepRow(std::size_t plan, std::size_t step) const
+      -> std::size_t {
+    if (step >= plan_step_rows[plan]) {
+      return kStatsMaxStepRows - 1;
+    }
+    return static_cast<std::size_t>(plan_first_step_row[plan]) + step;
+  }
+
+  // Upper bound in ns of the bucket holding the q-quantile of one
+  // step_latency row.
+  [[nodiscard]] auto stepQuantile(std::size_t row, double q) const
+      -> std::uint64_t {
+    const auto& buckets = step_latency[row];
+    std::uint64_t total = 0;
+    for (auto count : buckets) {
+      total += count;
+    }
+    if (total == 0) {
+      return 0;
+    }
+    const auto rank =
+        static_cast<std::uint64_t>(q * static_cast<double>(total));
+    std::uint64_t seen = 0;
+    for (std::size_t b = 0; b < kStatsLatencyBuckets; ++b) {
+      seen += buckets[b];
+      if (seen > rank) {
+        return std::uint64_t{1} << b;
+      }
+    }
+    return std::uint64_t{1} << (kStatsLatencyBuckets - 1);
+  }
+};
+
+namespace detail {
+
+using Counter = std::atomic<std::uint64_t>;
+using LatencyCounters = std::array<Counter, kStatsLatencyBuckets>;
+
+// Written only by the thread that owns it, read by collectors. Shards are
+// never freed: a thread that exits releases its shard to the next new thread
+// and its counts stay in place, so collection is a plain list walk.
+struct StatsShard {
+  StatsShard* next = nullptr;
+  std::atomic<bool> owned{true};
+
+  Counter chains_started{0};
+  Counter chains_completed{0};
+  Counter chains_failed{0};
+  Counter timeouts{0};
+  Counter cancellations{0};
+  // Started and finished chains may be on different threads, so the live
+  // total is only meaningful summed over all shards.
+  Counter frame_bytes_started{0};
+  Counter frame_bytes_done{0};
+  std::array<Counter, kStatsMaxAttempts> retries{};
+  std::array<Counter, kStatsSpeculationOutcomes> speculations{};
+  std::array<LatencyCounters, kStatsMaxStepRows> step_latency{};
+  std::array<Counter, kStatsMaxStepRows> step_latency_sum_ns{};
+  std::array<Counter, kStatsMaxPlans> plan_failed{};
+  std::array<LatencyCounters, kStatsMaxPlans> plan_latency{};
+  std::array<Counter, kStatsMaxPlans> plan_latency_sum_ns{};
+  // Open-addressed by the owner; a published code never changes.
+  std::array<std::atomic<std::int64_t>, kStatsMaxErrorCodes> error_codes{};
+  std::array<Counter, kStatsMaxErrorCodes> error_counts{};
+  Counter errors_other{0};
+};
+
+// Single writer, so a plain load and store instead of a locked add.
+inline void bump(Counter& counter, std::uint64_t by = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+}
+
+inline auto latencyBucket(std::uint64_t ns) -> std::size_t {
+  return ns == 0 ? 0
+                 : std::min<std::size_t>(64 - __builtin_clzll(ns),
+                                         kStatsLatencyBuckets - 1);
+}
+
+inline std::atomic<StatsShard*> stats_shards{nullptr};
+inline std::atomic<std::uint64_t> peak_live_frame_bytes{0};
+
+struct Gauge {
+  std::size_t id;
+  std::string name;
+  std::function<std::uint64_t()> read;
+};
+
+// A plan's stats slot and the first of its step_latency rows.
+struct StatsPlan {
+  std::size_t id;
+  std::size_t first_step_row;
+};
+
+// Registration only: plans and gauges. Recording never takes it.
+struct StatsRegistry {
+  std::mutex mutex;
+  std::vector<std::string> plans;
+  std::vector<std::size_t> plan_first_step_row;
+  std::vector<std::size_t> plan_step_rows;
+  std::size_t next_step_row = 0;
+  std::vector<Gauge> gauges;
+  std::size_t next_gauge = 0;
+};
+
+inline auto statsRegistry() -> StatsRegistry& {
+  static StatsRegistry registry;
+  return registry;
+}
+
+inline auto acquireShard() -> StatsShard* {
+  for (auto* shard = stats_shards.load(std::memory_order_acquire);
+       shard != nullptr; shard = shard->next) {
+    bool expected = false;
+    if (shard->owned.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire)) {
+      return shard;
+    }
+  }
+  auto* shard = new StatsShard;
+  shard->next = stats_shards.load(std::memory_order_relaxed);
+  while (!stats_shards.compare_exchange_weak(shard->next, shard,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+  }
+  return shard;
+}
+
+class ShardOwner {
+ public:
+  ShardOwner() : shard_(acquireShard()) {}
+  ShardOwner(const ShardOwner&) = delete;
+  auto operator=(const ShardOwner&) -> ShardOwner& = delete;
+  ~ShardOwner() { shard_->owned.store(false, std::memory_order_release); }
+
+  auto shard() -> StatsShard& { return *shard_; }
+
+ private:
+  StatsShard* shard_;
+};
+
+inline auto statsShard() -> StatsShard& {
+  thread_local ShardOwner owner;
+  return owner.shard();
+}
+
+inline auto registerStatsPlan(std::size_t steps) -> StatsPlan {
+  auto& registry = statsRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  const auto id = std::min(registry.plans.size(), kStatsMaxPlans - 1);
+  if (registry.plans.size() + 1 == kStatsMaxPlans) {
+    registry.plans.push_back("other");
+    registry.plan_first_step_row.push_back(kStatsMaxStepRows - 1);
+    registry.plan_step_rows.push_back(0);
+  } else if (registry.plans.size() < kStatsMaxPlans) {
+    registry.plans.push_back("plan" + std::to_string(id) + "_" +
+                             std::to_string(steps) + "steps");
+    // The last row is kept for the plans that do not fit.
+    const bool fits = registry.next_step_row + steps < kStatsMaxStepRows;
+    registry.plan_first_step_row.push_back(
+        fits ? registry.next_step_row : kStatsMaxStepRows - 1);
+    registry.plan_step_rows.push_back(fits ? steps : 0);
+    if (fits) {
+      registry.next_step_row += steps;
+    }
+  }
+  return StatsPlan{id, registry.plan_first_step_row[id]};
+}
+
+inline void recordChainStarted(std::size_t frame_bytes) {
+  auto& shard = statsShard();
+  bump(shard.chains_started);
+  bump(shard.frame_bytes_started, frame_bytes);
+}
+
+inline void recordErrorCode(StatsShard& shard, std::int64_t code) {
+  const auto start = static_cast<std::size_t>(code) % kStatsMaxErrorCodes;
+  for (std::size_t i = 0; i < kStatsMaxErrorCodes; ++i) {
+    const auto slot = (start + i) % kStatsMaxErrorCodes;
+    auto& count = shard.error_counts[slot];
+    if (count.load(std::memory_order_relaxed) == 0) {
+      shard.error_codes[slot].store(code, std::memory_order_relaxed);
+      count.store(1, std::memory_order_release);
+      return;
+    }
+    if (shard.error_codes[slot].load(std::memory_order_relaxed) == code) {
+      bump(count);
+      return;
+    }
+  }
+  bump(shard.errors_other);
+}
+
+inline void recordChainDone(std::size_t plan, std::uint64_t ns,
+                            const std::optional<std::int64_t>& error,
+                            std::size_t frame_bytes) {
+  auto& shard = statsShard();
+  bump(shard.chains_completed);
+  bump(shard.frame_bytes_done, frame_bytes);
+  bump(shard.plan_latency[plan][latencyBucket(ns)]);
+  bump(shard.plan_latency_sum_ns[plan], ns);
+  if (error) {
+    bump(shard.chains_failed);
+    bump(shard.plan_failed[plan]);
+    recordErrorCode(shard, *error);
+  }
+}
+
+inline void recordRetry(std::size_t attempt) {
+  bump(statsShard().retries[std::min(attempt, kStatsMaxAttempts - 1)]);
+}
+
+enum class SpeculationOutcome : std::size_t {
+  kCommitted = 0,  // validation confirmed the value; speculative result used
+  kRerun = 1,      // validation changed the value; fetch ran again
+  kDiscarded = 2,  // validation failed; speculative result dropped
+};
+
+inline void recordSpeculation(SpeculationOutcome outcome) {
+  bump(statsShard().speculations[static_cast<std::size_t>(outcome)]);
+}
+
+// `first_row` is the plan's StatsPlan::first_step_row; the shared last row
+// when its steps did not fit.
+inline void recordStepLatency(std::size_t first_row, std::size_t step,
+                              std::uint64_t ns) {
+  auto& shard = statsShard();
+  const auto row = first_row == kStatsMaxStepRows - 1
+                       ? first_row
+                       : std::min(first_row + step, kStatsMaxStepRows - 1);
+  bump(shard.step_latency[row][latencyBucket(ns)]);
+  bump(shard.step_latency_sum_ns[row], ns);
+}
+
+inline void addShard(StatsData& into, const StatsShard& shard) {
+  constexpr auto relaxed = std::memory_order_relaxed;
+  into.chains_started += shard.chains_started.load(relaxed);
+  into.chains_completed += shard.chains_completed.load(relaxed);
+  into.chains_failed += shard.chains_failed.load(relaxed);
+  into.timeouts += shard.timeouts.load(relaxed);
+  into.cancellations += shard.cancellations.load(relaxed);
+  into.errors_other += shard.errors_other.load(relaxed);
+  into.live_frame_bytes += shard.frame_bytes_started.load(relaxed);
+  into.live_frame_bytes -= shard.frame_bytes_done.load(relaxed);
+  for (std::size_t a = 0; a < kStatsMaxAttempts; ++a) {
+    into.retries[a] += shard.retries[a].load(relaxed);
+  }
+  for (std::size_t o = 0; o < kStatsSpeculationOutcomes; ++o) {
+    into.speculations[o] += shard.speculations[o].load(relaxed);
+  }
+  for (std::size_t r = 0; r < kStatsMaxStepRows; ++r) {
+    for (std::size_t b = 0; b < kStatsLatencyBuckets; ++b) {
+      into.step_latency[r][b] += shard.step_latency[r][b].load(relaxed);
+    }
+    into.step_latency_sum_ns[r] += shard.step_latency_sum_ns[r].load(relaxed);
+  }
+  for (std::size_t p = 0; p < kStatsMaxPlans; ++p) {
+    into.plan_failed[p] += shard.plan_failed[p].load(relaxed);
+    for (std::size_t b = 0; b < kStatsLatencyBuckets; ++b) {
+      into.plan_latency[p][b] += shard.plan_latency[p][b].load(relaxed);
+    }
+    into.plan_latency_sum_ns[p] += shard.plan_latency_sum_ns[p].load(relaxed);
+  }
+  for (std::size_t i = 0; i < kStatsMaxErrorCodes; ++i) {
+    const auto count = shard.error_counts[i].load(std::memory_order_acquire);
+    if (count == 0) {
+      continue;
+    }
+    const auto code = shard.error_codes[i].load(relaxed);
+    auto* end = into.error_codes + into.error_code_count;
+    auto* it = std::find_if(into.error_codes, end, [code](const auto& e) {
+      return e.code == code;
+    });
+    if (it != end) {
+      it->count += count;
+    } else if (into.error_code_count < kStatsMaxErrorCodes) {
+      *end = StatsErrorCount{code, count};
+      ++into.error_code_count;
+    } else {
+      into.errors_other += count;
+    }
+  }
+}
+
+}  // namespace detail
+
+// For features that give up on a step after a deadline or cancel pending
+// work; exported as async_chain_timeouts_total and
+// async_chain_cancellations_total.
+inline void recordStatsTimeout() {
+  if constexpr (kStatsBuilt) {
+    detail::bump(detail::statsShard().timeouts);
+  }
+}
+
+inline void recordStatsCancellation() {
+  if constexpr (kStatsBuilt) {
+    detail::bump(detail::statsShard().cancellations);
+  }
+}
+
+// Replaces a plan's default "plan<id>_<n>steps" label, see
+// AsyncChain::statsPlan().
+inline void nameStatsPlan(std::size_t plan, std::string name) {
+  auto& registry = detail::statsRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  if (plan < registry.plans.size()) {
+    registry.plans[plan] = std::move(name);
+  }
+}
+
+// Adds a value sampled whenever stats are collected, e.g. an executor's
+// queue depth or a breaker's state. Returns an id for removeStatsGauge.
+inline auto addStatsGauge(std::string name,
+                          std::function<std::uint64_t()> read)
+    -> std::size_t {
+  auto& registry = detail::statsRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  const auto id = registry.next_gauge++;
+  registry.gauges.push_back(
+      detail::Gauge{id, std::move(name), std::move(read)});
+  return id;
+}
+
+inline void removeStatsGauge(std::size_t id) {
+  auto& registry = detail::statsRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.gauges.erase(
+      std::remove_if(registry.gauges.begin(), registry.gauges.end(),
+                     [id](const detail::Gauge& g) { return g.id == id; }),
+      registry.gauges.end());
+}
+
+// Sums every thread's shard without blocking them, then samples the plan
+// names and gauges.
+inline auto collectStats() -> StatsData {
+  StatsData data{};
+  for (const auto* shard =
+           detail::stats_shards.load(std::memory_order_acquire);
+       shard != nullptr; shard = shard->next) {
+    detail::addShard(data, *shard);
+  }
+  // A chain that finished on a shard already read but started on one read
+  // later can make the sum briefly negative; wrap-around means zero.
+  if (static_cast<std::int64_t>(data.live_frame_bytes) < 0) {
+    data.live_frame_bytes = 0;
+  }
+  auto peak = detail::peak_live_frame_bytes.load(std::memory_order_relaxed);
+  while (peak < data.live_frame_bytes &&
+         !detail::peak_live_frame_bytes.compare_exchange_weak(
+             peak, data.live_frame_bytes, std::memory_order_relaxed)) {
+  }
+  data.peak_live_frame_bytes = std::max(peak, data.live_frame_bytes);
+  auto& registry = detail::statsRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  data.plan_count = registry.plans.size();
+  for (std::size_t p = 0; p < data.plan_count; ++p) {
+    std::strncpy(data.plan_names[p], registry.plans[p].c_str(),
+                 kStatsPlanNameSize - 1);
+    data.plan_first_step_row[p] = registry.plan_first_step_row[p];
+    data.plan_step_rows[p] = registry.plan_step_rows[p];
+  }
+  data.gauge_count = std::min(registry.gauges.size(), kStatsMaxGauges);
+  for (std::size_t g = 0; g < data.gauge_count; ++g) {
+    auto& out = data.gauges[g];
+    std::strncpy(out.name, registry.gauges[g].name.c_str(),
+                 kStatsGaugeNameSize - 1);
+    out.value = registry.gauges[g].read();
+  }
+  data.published_unix_ns = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  return data;
+}
+
+// Layout of the shared-memory file. The writer bumps `sequence` to odd,
+// copies `data`, then bumps it to even; readers retry until they see the
+// same even value before and after their copy.
+struct StatsSegmentLayout {
+  static constexpr std::uint64_t kMagic = 0x5354415453434841ULL;
+  static constexpr std::uint32_t kVersion = 5;
+
+  std::uint64_t magic;
+  std::uint32_t version;
+  std::uint32_t size;
+  std::atomic<std::uint64_t> sequence;
+  StatsData data;
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "the segment sequence must be usable across processes");
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// Publishes collectStats() to a memory-mapped file every `interval` from its
+// own thread. External readers use readStatsSegment().
+class StatsPublisher {
+ public:
+  explicit StatsPublisher(
+      const std::string& path,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+      : interval_(interval) {
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ::ftruncate(fd, sizeof(StatsSegmentLayout)) != 0) {
+      const int error = errno;
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    void* mapped = ::mmap(nullptr, sizeof(StatsSegmentLayout),
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    segment_ = new (mapped) StatsSegmentLayout;
+    segment_->sequence.store(1, std::memory_order_relaxed);
+    segment_->magic = StatsSegmentLayout::kMagic;
+    segment_->version = StatsSegmentLayout::kVersion;
+    segment_->size = sizeof(StatsSegmentLayout);
+    segment_->data = StatsData{};
+    segment_->sequence.store(2, std::memory_order_release);
+    thread_ = std::thread([this] { run(); });
+  }
+
+  StatsPublisher(const StatsPublisher&) = delete;
+  auto operator=(const StatsPublisher&) -> StatsPublisher& = delete;
+
+  // Publishes a last snapshot; the file stays for readers to inspect.
+  ~StatsPublisher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    publish();
+    ::munmap(segment_, sizeof(StatsSegmentLayout));
+  }
+
+  void publish() {
+    std::lock_guard<std::mutex> writer(publish_mutex_);
+    const auto data = collectStats();
+    const auto seq = segment_->sequence.load(std::memory_order_relaxed);
+    segment_->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&segment_->data, &data, sizeof(data));
+    segment_->sequence.store(seq + 2, std::memory_order_release);
+  }
+
+ private:
+  StatsSegmentLayout* segment_ = nullptr;
+  std::chrono::milliseconds interval_;
+  std::mutex publish_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::thread thread_;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, interval_, [this] { return stopping_; })) {
+      lock.unlock();
+      publish();
+      lock.lock();
+    }
+  }
+};
+
+// Maps a segment read-only and copies a consistent snapshot; nullopt when
+// the file is missing or not a segment of this version.
+inline auto readStatsSegment(const std::string& path)
+    -> std::optional<StatsData> {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  struct stat info {};
+  if (::fstat(fd, &info) != 0 ||
+      static_cast<std::size_t>(info.st_size) < sizeof(StatsSegmentLayout)) {
+    ::close(fd);
+    return std::nullopt;
+  }
+  void* mapped =
+      ::mmap(nullptr, sizeof(StatsSegmentLayout), PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    return std::nullopt;
+  }
+  const auto* segment = static_cast<const StatsSegmentLayout*>(mapped);
+  std::optional<StatsData> out;
+  if (segment->magic == StatsSegmentLayout::kMagic &&
+      segment->version == StatsSegmentLayout::kVersion &&
+      segment->size == sizeof(StatsSegmentLayout)) {
+    StatsData data;
+    for (;;) {
+      const auto before = segment->sequence.load(std::memory_order_acquire);
+      if (before % 2 == 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::memcpy(&data, &segment->data, sizeof(data));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (segment->sequence.load(std::memory_order_relaxed) == before) {
+        break;
+      }
+    }
+    out = data;
+  }
+  ::munmap(mapped, sizeof(StatsSegmentLayout));
+  return out;
+}
+
+#endif
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef WORKSPACES_CPP20_STEP_TIMING_HPP
+#define WORKSPACES_CPP20_STEP_TIMING_HPP
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#endif
+
+// Step timing is compiled in only with -DASYNC_CHAIN_STEP_TIMING=1: even a
+// never-taken branch per step stops the compiler from flattening short
+// chains, which costs several times the untimed step.
+#if !defined(ASYNC_CHAIN_STEP_TIMING)
+#define ASYNC_CHAIN_STEP_TIMING 0
+#endif
+
+namespace async_chain {
+
+inline constexpr bool kStepTimingBuilt = ASYNC_CHAIN_STEP_TIMING != 0;
+
+// Totals for one step index of one chain plan. wall_ns runs from the step
+// being entered to its continuation being called, so it includes retry
+// delays and I/O waits; cpu_ns is thread CPU time of the step's synchronous
+// segments only.
+struct StepTiming {
+  std::uint64_t calls = 0;
+  std::uint64_t wall_ns = 0;
+  std::uint64_t cpu_ns = 0;
+};
+
+struct PlanTimings {
+  std::string plan;
+  std::vector<StepTiming> steps;
+};
+
+namespace detail {
+
+inline std::atomic<bool> step_timing_enabled{false};
+
+struct StepCounters {
+  std::atomic<std::uint64_t> calls{0};
+  std::atomic<std::uint64_t> wall_ns{0};
+  std::atomic<std::uint64_t> cpu_ns{0};
+};
+
+struct PlanCounters {
+  std::string name;
+  std::size_t size;
+  std::unique_ptr<StepCounters[]> steps;
+
+  PlanCounters(std::string plan_name, std::size_t step_count)
+      : name(std::move(plan_name)),
+        size(step_count),
+        steps(new StepCounters[step_count]) {}
+};
+
+struct PlanRegistry {
+  std::mutex mutex;
+  std::vector<PlanCounters*> plans;
+};
+
+inline auto planRegistry() -> PlanRegistry& {
+  static PlanRegistry registry;
+  return registry;
+}
+
+inline auto typeName(const std::type_info& type) -> std::string {
+#if defined(__GNUG__)
+  int status = 0;
+  char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+  if (status == 0 && demangled != nullptr) {
+    std::string name = demangled;
+    std::free(demangled);
+    return name;
+  }
+#endif
+  return type.name();
+}
+
+// One per chain type, registered the first time the plan runs with timing
+// enabled and never freed.
+template <typename Plan, std::size_t Steps>
+auto planCounters() -> PlanCounters& {
+  static PlanCounters* counters = [] {
+    auto* plan = new PlanCounters(typeName(typeid(Plan)), Steps);
+    auto& registry = planRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.plans.push_back(plan);
+    return plan;
+  }();
+  return *counters;
+}
+
+inline auto nowNs() -> std::uint64_t {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+inline auto threadCpuNs() -> std::uint64_t {
+#if defined(__unix__) || defined(__APPLE__)
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000U +
+         static_cast<std::uint64_t>(ts.tv_nsec);
+#else
+  return 0;
+#endif
+}
+
+// The step whose synchronous segment is running on this thread. A step that
+// starts a nested chain hands the thread to the inner steps; its own CPU time
+// after that is not attributed.
+struct OpenSegment {
+  StepCounters* step = nullptr;
+  std::uint64_t cpu_start = 0;
+};
+
+inline thread_local OpenSegment open_segment;
+
+inline void closeSegment() {
+  if (open_segment.step != nullptr) {
+    open_segment.step->cpu_ns.fetch_add(threadCpuNs() - open_segment.cpu_start,
+                                        std::memory_order_relaxed);
+    open_segment.step = nullptr;
+  }
+}
+
+inline void closeSegment(StepCounters& step) {
+  if (open_segment.step == &step) {
+    closeSegment();
+  }
+}
+
+// Returns the wall-clock start to hand to stepEnd.
+inline auto stepBegin(StepCounters& step) -> std::uint64_t {
+  closeSegment();
+  open_segment = OpenSegment{&step, threadCpuNs()};
+  return nowNs();
+}
+
+// Returns the step's wall time.
+inline auto stepEnd(StepCounters& step, std::uint64_t started)
+    -> std::uint64_t {
+  closeSegment(step);
+  const auto wall_ns = nowNs() - started;
+  step.calls.fetch_add(1, std::memory_order_relaxed);
+  step.wall_ns.fetch_add(wall_ns, std::memory_order_relaxed);
+  return wall_ns;
+}
+
+inline auto snapshot(const PlanCounters& plan) -> PlanTimings {
+  PlanTimings timings{plan.name, std::vector<StepTiming>(plan.size)};
+  for (std::size_t i = 0; i < plan.size; ++i) {
+    timings.steps[i].calls =
+        plan.steps[i].calls.load(std::memory_order_relaxed);
+    timings.steps[i].wall_ns =
+        plan.steps[i].wall_ns.load(std::memory_order_relaxed);
+    timings.steps[i].cpu_ns =
+        plan.steps[i].cpu_ns.load(std::memory_order_relaxed);
+  }
+  return timings;
+}
+
+}  // namespace detail
+
+// Off by default; when built in but off, a step costs one relaxed load.
+// Steps that have already started keep being timed until they finish.
+inline void setStepTiming(bool enabled) {
+  detail::step_timing_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+// Every plan that has run with timing enabled.
+inline auto stepTimings() -> std::vector<PlanTimings> {
+  auto& registry = detail::planRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::vector<PlanTimings> out;
+  out.reserve(registry.plans.size());
+  for (const auto* plan : registry.plans) {
+    out.push_back(detail::snapshot(*plan));
+  }
+  return out;
+}
+
+inline void resetStepTimings() {
+  auto& registry = detail::planRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (auto* plan : registry.plans) {
+    for (std::size_t i = 0; i < plan->size; ++i) {
+      plan->steps[i].calls.store(0, std::memory_order_relaxed);
+      plan->steps[i].wall_ns.store(0, std::memory_order_relaxed);
+      plan->steps[i].cpu_ns.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+}  // namespace async_chain
+
+#endif
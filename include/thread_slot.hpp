@@ -0,0 +1,87 @@
+#ifndef WORKSPACES_CPP20_THREAD_SLOT_HPP
+#define WORKSPACES_CPP20_THREAD_SLOT_HPP
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace async_chain {
+
+namespace detail {
+
+// Names one object's entry in per-thread tables, e.g. a pool's per-thread
+// cache, see threadSlot(). Indexes of destroyed keys are reused, so the
+// tables grow with the most keys alive at once; the generation tells an
+// entry left by an earlier owner of the index.
+class ThreadSlotKey {
+ public:
+  ThreadSlotKey() {
+    auto& registry = keyRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    generation_ = ++registry.generation;
+    if (registry.free.empty()) {
+      index_ = registry.next_index++;
+    } else {
+      index_ = registry.free.back();
+      registry.free.pop_back();
+    }
+  }
+
+  ThreadSlotKey(const ThreadSlotKey&) = delete;
+  auto operator=(const ThreadSlotKey&) -> ThreadSlotKey& = delete;
+
+  ~ThreadSlotKey() {
+    auto& registry = keyRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.free.push_back(index_);
+  }
+
+  [[nodiscard]] auto index() const -> std::size_t { return index_; }
+  [[nodiscard]] auto generation() const -> std::uint64_t {
+    return generation_;
+  }
+
+ private:
+  struct Registry {
+    std::mutex mutex;
+    std::vector<std::size_t> free;
+    std::size_t next_index = 0;
+    std::uint64_t generation = 0;
+  };
+
+  static auto keyRegistry() -> Registry& {
+    static Registry registry;
+    return registry;
+  }
+
+  std::size_t index_ = 0;
+  std::uint64_t generation_ = 0;
+};
+
+// The calling thread's entry for `key`; null until the thread sets it, and
+// again once the key is destroyed and its index reused.
+inline auto threadSlot(const ThreadSlotKey& key) -> void*& {
+  struct Slot {
+    std::uint64_t generation = 0;
+    void* value = nullptr;
+  };
+  thread_local std::vector<Slot> slots;
+  if (slots.size() <= key.index()) {
+    slots.resize(key.index() + 1);
+  }
+  auto& slot = slots[key.index()];
+  if (slot.generation != key.generation()) {
+    slot.generation = key.generation();
+    slot.value = nullptr;
+  }
+  return slot.value;
+}
+
+}  // namespace detail
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,732 @@
+#ifndef WORKSPACES_CPP20_TIMER_HPP
+#define WORKSPACES_CPP20_TIMER_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "async.hpp"
+#include "stats.hpp"
+
+namespace async_chain {
+
+// Timer queues share one interface so BasicTimerScheduler and the benchmarks
+// can swap them:
+//
+//   auto insert(Task, std::size_t delay_ms, Clock::time_point now) -> Handle;
+//   auto cancel(const Handle&) -> bool;
+//   auto deadline(const Handle&) const -> Clock::time_point;
+//   auto nextExpiry() const -> std::optional<Clock::time_point>;
+//   auto expire(Clock::time_point now, std::vector<Task>& out) -> std::size_t;
+//   auto size() const -> std::size_t;
+//   auto bytes() const -> std::size_t;
+//
+// expire() moves every due task into `out` and returns the number of expiry
+// groups (slots or ticks) it drained. bytes() is the queue's own storage,
+// capacity included; captures too large for a std::function's inline buffer
+// are not counted.
+
+using TimerTask = std::function<void()>;
+using TimerClock = std::chrono::steady_clock;
+
+namespace detail {
+
+// Red-black tree node header of std::map: colour, parent and two children.
+inline constexpr std::size_t kMapNodeBytes = 4 * sizeof(void*);
+
+// Per-delay slack tolerance of ± delay * slack. A deadline is rounded to the
+// nearest multiple of 2 * delay * slack, so timers with nearby deadlines land
+// on the same instant; none lands before `now`.
+class SlackPolicy {
+ public:
+  explicit SlackPolicy(double default_fraction = 0)
+      : default_(default_fraction) {}
+
+  void setDefault(double fraction) { default_ = fraction; }
+  void set(std::size_t delay_ms, double fraction) {
+    per_delay_[delay_ms] = fraction;
+  }
+
+  [[nodiscard]] auto deadline(TimerClock::time_point now,
+                              std::size_t delay_ms) const
+      -> TimerClock::time_point {
+    const auto exact = now + std::chrono::milliseconds(delay_ms);
+    auto it = per_delay_.find(delay_ms);
+    const double fraction = it == per_delay_.end() ? default_ : it->second;
+    const auto width = static_cast<std::int64_t>(
+        static_cast<double>(delay_ms) * 2e6 * fraction);
+    if (width <= 0) {
+      return exact;
+    }
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        exact.time_since_epoch())
+                        .count();
+    const auto rounded = (ns + width / 2) / width * width;
+    return std::max(now, TimerClock::time_point(
+                             std::chrono::duration_cast<TimerClock::duration>(
+                                 std::chrono::nanoseconds(rounded))));
+  }
+
+ private:
+  double default_;
+  std::unordered_map<std::size_t, double> per_delay_;
+};
+
+}  // namespace detail
+
+// Ordered map of expiry slots. Deadlines are rounded by the slack policy, so
+// timers with nearby deadlines share one slot and expire together. A timer
+// fires within deadline ± delay * slack; with zero slack every deadline is
+// kept exact.
+class CoalescingTimerQueue {
+ public:
+  using Task = TimerTask;
+  using Clock = TimerClock;
+
+  struct Handle {
+    Clock::time_point slot;
+    std::uint64_t slot_id = 0;
+    std::size_t index = 0;
+  };
+
+  explicit CoalescingTimerQueue(double default_slack = 0)
+      : slack_(default_slack) {}
+
+  // Slack as a fraction of the delay, e.g. 0.05 for 5%.
+  void setDefaultSlack(double fraction) { slack_.setDefault(fraction); }
+  void setSlack(std::size_t delay_ms, double fraction) {
+    slack_.set(delay_ms, fraction);
+  }
+
+  auto insert(Task task, std::size_t delay_ms, Clock::time_point now)
+      -> Handle {
+    const auto at = slack_.deadline(now, delay_ms);
+    auto& slot = slots_[at];
+    if (slot.tasks.empty()) {
+      slot.id = ++next_slot_id_;
+    }
+    slot.tasks.push_back(std::move(task));
+    ++size_;
+    return Handle{at, slot.id, slot.tasks.size() - 1};
+  }
+
+  auto cancel(const Handle& handle) -> bool {
+    auto it = slots_.find(handle.slot);
+    if (it == slots_.end() || it->second.id != handle.slot_id ||
+        !it->second.tasks[handle.index]) {
+      return false;
+    }
+    it->second.tasks[handle.index] = nullptr;
+    --size_;
+    if (++it->second.cancelled == it->second.tasks.size()) {
+      slots_.erase(it);
+    }
+    return true;
+  }
+
+  [[nodiscard]] auto deadline(const Handle& handle) const
+      -> Clock::time_point {
+    return handle.slot;
+  }
+
+  [[nodiscard]] auto nextExpiry() const -> std::optional<Clock::time_point> {
+    if (slots_.empty()) {
+      return std::nullopt;
+    }
+    return slots_.begin()->first;
+  }
+
+  auto expire(Clock::time_point now, std::vector<Task>& out) -> std::size_t {
+    std::size_t expired = 0;
+    while (!slots_.empty() && slots_.begin()->first <= now) {
+      auto& slot = slots_.begin()->second;
+      size_ -= slot.tasks.size() - slot.cancelled;
+      for (auto& task : slot.tasks) {
+        if (task) {
+          out.push_back(std::move(task));
+        }
+      }
+      slots_.erase(slots_.begin());
+      ++expired;
+    }
+    return expired;
+  }
+
+  [[nodiscard]] auto size() const -> std::size_t { return size_; }
+  [[nodiscard]] auto slotCount() const -> std::size_t { return slots_.size(); }
+
+  [[nodiscard]] auto bytes() const -> std::size_t {
+    std::size_t total = 0;
+    for (const auto& entry : slots_) {
+      total += detail::kMapNodeBytes + sizeof(entry) +
+               entry.second.tasks.capacity() * sizeof(Task);
+    }
+    return total;
+  }
+
+ private:
+  struct Slot {
+    std::vector<Task> tasks;
+    std::size_t cancelled = 0;
+    std::uint64_t id = 0;
+  };
+
+  std::map<Clock::time_point, Slot> slots_;
+  detail::SlackPolicy slack_;
+  std::uint64_t next_slot_id_ = 0;
+  std::size_t size_ = 0;
+};
+
+// Binary min-heap over a node pool; nodes track their heap position so
+// cancel() is O(log n) instead of leaving tombstones behind.
+class HeapTimerQueue {
+ public:
+  using Task = TimerTask;
+  using Clock = TimerClock;
+
+  struct Handle {
+    std::uint32_t index = 0;
+    std::uint32_t generation = 0;
+  };
+
+  auto insert(Task task, std::size_t delay_ms, Clock::time_point now)
+      -> Handle {
+    const auto index = allocate();
+    auto& node = nodes_[index];
+    node.deadline = now + std::chrono::milliseconds(delay_ms);
+    node.task = std::move(task);
+    node.heap_pos = static_cast<std::uint32_t>(heap_.size());
+    heap_.push_back(index);
+    siftUp(node.heap_pos);
+    return Handle{index, node.generation};
+  }
+
+  auto cancel(const Handle& handle) -> bool {
+    if (!live(handle)) {
+      return false;
+    }
+    removeAt(nodes_[handle.index].heap_pos);
+    release(handle.index);
+    return true;
+  }
+
+  [[nodiscard]] auto deadline(const Handle& handle) const
+      -> Clock::time_point {
+    return nodes_[handle.index].deadline;
+  }
+
+  [[nodiscard]] auto nextExpiry() const -> std::optional<Clock::time_point> {
+    if (heap_.empty()) {
+      return std::nullopt;
+    }
+    return nodes_[heap_.front()].deadline;
+  }
+
+  auto expire(Clock::time_point now, std::vector<Task>& out) -> std::size_t {
+    std::size_t expired = 0;
+    while (!heap_.empty() && nodes_[heap_.front()].deadline <= now) {
+      const auto index = heap_.front();
+      out.push_back(std::move(nodes_[index].task));
+      removeAt(0);
+      release(index);
+      ++expired;
+    }
+    return expired;
+  }
+
+  [[nodiscard]] auto size() const -> std::size_t { return heap_.size(); }
+
+  [[nodiscard]] auto bytes() const -> std::size_t {
+    return nodes_.capacity() * sizeof(Node) +
+           (free_.capacity() + heap_.capacity()) * sizeof(std::uint32_t);
+  }
+
+ private:
+  static constexpr std::uint32_t kFree = UINT32_MAX;
+
+  struct Node {
+    Clock::time_point deadline;
+    Task task;
+    std::uint32_t heap_pos = kFree;
+    std::uint32_t generation = 0;
+  };
+
+  std::vector<Node> nodes_;
+  std::vector<std::uint32_t> free_;
+  std::vector<std::uint32_t> heap_;
+
+  [[nodiscard]] auto live(const Handle& handle) const -> bool {
+    return handle.index < nodes_.size() &&
+           nodes_[handle.index].generation == handle.generation &&
+           nodes_[handle.index].heap_pos != kFree;
+  }
+
+  auto allocate() -> std::uint32_t {
+    if (!free_.empty()) {
+      const auto index = free_.back();
+      free_.pop_back();
+      return index;
+    }
+    nodes_.emplace_back();
+    return static_cast<std::uint32_t>(nodes_.size() - 1);
+  }
+
+  void release(std::uint32_t index) {
+    auto& node = nodes_[index];
+    node.task = nullptr;
+    node.heap_pos = kFree;
+    ++node.generation;
+    free_.push_back(index);
+  }
+
+  auto earlier(std::uint32_t a, std::uint32_t b) const -> bool {
+    return nodes_[heap_[a]].deadline < nodes_[heap_[b]].deadline;
+  }
+
+  void swapAt(std::uint32_t a, std::uint32_t b) {
+    std::swap(heap_[a], heap_[b]);
+    nodes_[heap_[a]].heap_pos = a;
+    nodes_[heap_[b]].heap_pos = b;
+  }
+
+  void siftUp(std::uint32_t pos) {
+    while (pos > 0) {
+      const auto parent = (pos - 1) / 2;
+      if (!earlier(pos, parent)) {
+        break;
+      }
+      swapAt(pos, parent);
+      pos = parent;
+    }
+  }
+
+  void siftDown(std::uint32_t pos) {
+    const auto count = static_cast<std::uint32_t>(heap_.size());
+    for (;;) {
+      auto best = pos;
+      const auto left = 2 * pos + 1;
+      if (left < count && earlier(left, best)) {
+        best = left;
+      }
+      if (left + 1 < count && earlier(left + 1, best)) {
+        best = left + 1;
+      }
+      if (best == pos) {
+        return;
+      }
+      swapAt(pos, best);
+      pos = best;
+    }
+  }
+
+  void removeAt(std::uint32_t pos) {
+    const auto last = static_cast<std::uint32_t>(heap_.size() - 1);
+    if (pos != last) {
+      swapAt(pos, last);
+    }
+    heap_.pop_back();
+    if (pos < heap_.size()) {
+      siftDown(pos);
+      siftUp(pos);
+    }
+  }
+};
+
+// Hierarchical timing wheel with 1 ms ticks: four levels of 256 slots cover
+// 2^32 ms (about 49 days). Insert and cancel are O(1); timers cascade to finer
+// levels as time advances. With a slack policy it is a coalescing wheel:
+// rounded deadlines concentrate timers into fewer ticks.
+class WheelTimerQueue {
+ public:
+  using Task = TimerTask;
+  using Clock = TimerClock;
+
+  struct Handle {
+    std::uint32_t index = 0;
+    std::uint32_t generation = 0;
+  };
+
+  explicit WheelTimerQueue(double default_slack = 0)
+      : slack_(default_slack), origin_(Clock::now()) {
+    heads_.fill(kNil);
+  }
+
+  void setDefaultSlack(double fraction) { slack_.setDefault(fraction); }
+  void setSlack(std::size_t delay_ms, double fraction) {
+    slack_.set(delay_ms, fraction);
+  }
+
+  auto insert(Task task, std::size_t delay_ms, Clock::time_point now)
+      -> Handle {
+    if (size_ == 0) {
+      current_ = std::max(current_, ticksAt(now));
+    }
+    const auto at = slack_.deadline(now, delay_ms);
+    // Round up so a timer never fires before its deadline.
+    auto tick = ticksAt(at);
+    if (origin_ + std::chrono::milliseconds(tick) < at) {
+      ++tick;
+    }
+    const auto index = allocate();
+    auto& node = nodes_[index];
+    node.tick = std::max(tick, current_ + 1);
+    node.task = std::move(task);
+    link(index);
+    ++size_;
+    return Handle{index, node.generation};
+  }
+
+  auto cancel(const Handle& handle) -> bool {
+    if (handle.index >= nodes_.size() ||
+        nodes_[handle.index].generation != handle.generation ||
+        nodes_[handle.index].bucket == kNil) {
+      return false;
+    }
+    unlink(handle.index);
+    release(handle.index);
+    --size_;
+    return true;
+  }
+
+  [[nodiscard]] auto deadline(const Handle& handle) const
+      -> Clock::time_point {
+    return origin_ + std::chrono::milliseconds(nodes_[handle.index].tick);
+  }
+
+  // Earliest non-empty level-0 tick before the next cascade, or the cascade
+  // itself, which may move timers down into level 0.
+  [[nodiscard]] auto nextExpiry() const -> std::optional<Clock::time_point> {
+    if (size_ == 0) {
+      return std::nullopt;
+    }
+    const auto boundary = (current_ | (kSlots - 1)) + 1;
+    for (auto tick = current_ + 1; tick < boundary; ++tick) {
+      if (heads_[tick & (kSlots - 1)] != kNil) {
+        return origin_ + std::chrono::milliseconds(tick);
+      }
+    }
+    return origin_ + std::chrono::milliseconds(boundary);
+  }
+
+  auto expire(Clock::time_point now, std::vector<Task>& out) -> std::size_t {
+    const auto target = ticksAt(now);
+    if (size_ == 0) {
+      current_ = std::max(current_, target);
+      return 0;
+    }
+    std::size_t expired = 0;
+    while (current_ < target && size_ > 0) {
+      ++current_;
+      for (std::size_t level = kLevels - 1; level > 0; --level) {
+        const auto mask = (std::uint64_t{1} << (kSlotBits * level)) - 1;
+        if ((current_ & mask) == 0) {
+          cascade(level);
+        }
+      }
+      auto index = heads_[current_ & (kSlots - 1)];
+      if (index != kNil) {
+        ++expired;
+      }
+      while (index != kNil) {
+        const auto next = nodes_[index].next;
+        out.push_back(std::move(nodes_[index].task));
+        release(index);
+        --size_;
+        index = next;
+      }
+      heads_[current_ & (kSlots - 1)] = kNil;
+    }
+    current_ = std::max(current_, target);
+    return expired;
+  }
+
+  [[nodiscard]] auto size() const -> std::size_t { return size_; }
+
+  [[nodiscard]] auto bytes() const -> std::size_t {
+    return sizeof(heads_) + nodes_.capacity() * sizeof(Node) +
+           free_.capacity() * sizeof(std::uint32_t);
+  }
+
+ private:
+  static constexpr std::size_t kLevels = 4;
+  static constexpr std::size_t kSlotBits = 8;
+  static constexpr std::uint64_t kSlots = std::uint64_t{1} << kSlotBits;
+  static constexpr std::uint32_t kNil = UINT32_MAX;
+
+  struct Node {
+    std::uint64_t tick = 0;
+    Task task;
+    std::uint32_t prev = kNil;
+    std::uint32_t next = kNil;
+    std::uint32_t bucket = kNil;  // level * kSlots + slot, kNil when free
+    std::uint32_t generation = 0;
+  };
+
+  detail::SlackPolicy slack_;
+  Clock::time_point origin_;
+  std::uint64_t current_ = 0;  // last tick already expired
+  std::array<std::uint32_t, kLevels * kSlots> heads_{};
+  std::vector<Node> nodes_;
+  std::vector<std::uint32_t> free_;
+  std::size_t size_ = 0;
+
+  auto ticksAt(Clock::time_point t) const -> std::uint64_t {
+    if (t <= origin_) {
+      return 0;
+    }
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(t - origin_)
+            .count());
+  }
+
+  // The level is the highest byte in which the deadline differs from the
+  // current tick, so a slot is always cascaded before its timers are due.
+  void link(std::uint32_t index) {
+    auto& node = nodes_[index];
+    const auto diff = node.tick ^ current_;
+    std::size_t level = 0;
+    while (level + 1 < kLevels && (diff >> (kSlotBits * (level + 1))) != 0) {
+      ++level;
+    }
+    const auto slot = (node.tick >> (kSlotBits * level)) & (kSlots - 1);
+    const auto bucket = static_cast<std::uint32_t>(level * kSlots + slot);
+    node.bucket = bucket;
+    node.prev = kNil;
+    node.next = heads_[bucket];
+    if (node.next != kNil) {
+      nodes_[node.next].prev = index;
+    }
+    heads_[bucket] = index;
+  }
+
+  void unlink(std::uint32_t index) {
+    auto& node = nodes_[index];
+    if (node.prev != kNil) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      heads_[node.bucket] = node.next;
+    }
+    if (node.next != kNil) {
+      nodes_[node.next].prev = node.prev;
+    }
+    node.bucket = kNil;
+  }
+
+  void cascade(std::size_t level) {
+    const auto slot = (current_ >> (kSlotBits * level)) & (kSlots - 1);
+    const auto bucket = level * kSlots + slot;
+    auto index = heads_[bucket];
+    heads_[bucket] = kNil;
+    while (index != kNil) {
+      const auto next = nodes_[index].next;
+      link(index);
+      index = next;
+    }
+  }
+
+  auto allocate() -> std::uint32_t {
+    if (!free_.empty()) {
+      const auto index = free_.back();
+      free_.pop_back();
+      return index;
+    }
+    nodes_.emplace_back();
+    return static_cast<std::uint32_t>(nodes_.size() - 1);
+  }
+
+  void release(std::uint32_t index) {
+    auto& node = nodes_[index];
+    node.task = nullptr;
+    node.bucket = kNil;
+    ++node.generation;
+    free_.push_back(index);
+  }
+};
+
+struct TimerStats {
+  std::uint64_t scheduled = 0;
+  std::uint64_t cancelled = 0;
+  std::uint64_t fired = 0;
+  std::uint64_t slots_expired = 0;
+  std::uint64_t wakeups = 0;  // times the timer thread returned from a wait
+};
+
+// SchedulerFunction backed by a dedicated timer thread over any timer queue.
+// Expired tasks run on the timer thread, one batch at a time, unless
+// dispatchTo() routes them to an executor. Pending timers are discarded on
+// destruction.
+template <typename Queue>
+class BasicTimerScheduler {
+ public:
+  using Task = typename Queue::Task;
+  using Clock = typename Queue::Clock;
+  using Handle = typename Queue::Handle;
+
+  // Arguments are forwarded to the queue, e.g. its default slack.
+  template <typename... QueueArgs>
+  explicit BasicTimerScheduler(QueueArgs&&... args)
+      : queue_(std::forward<QueueArgs>(args)...) {
+    thread_ = std::thread([this] { run(); });
+  }
+
+  BasicTimerScheduler(const BasicTimerScheduler&) = delete;
+  BasicTimerScheduler(BasicTimerScheduler&&) = delete;
+  auto operator=(const BasicTimerScheduler&) -> BasicTimerScheduler& = delete;
+  auto operator=(BasicTimerScheduler&&) -> BasicTimerScheduler& = delete;
+
+  ~BasicTimerScheduler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  // Per-delay slack tolerance, e.g. setSlack(1000, 0.05) lets 1000 ms timers
+  // fire up to 50 ms early or late so they can share expiry slots.
+  void setSlack(std::size_t delay_ms, double fraction) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.setSlack(delay_ms, fraction);
+  }
+
+  auto schedule(Task task, std::size_t delay_ms) -> Handle {
+    bool rearm = false;
+    Handle handle;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      handle = queue_.insert(std::move(task), delay_ms, Clock::now());
+      ++stats_.scheduled;
+      rearm = queue_.deadline(handle) < armed_;
+    }
+    // The timer thread only needs to re-arm when the head moved forward.
+    if (rearm) {
+      wake_.notify_one();
+    }
+    return handle;
+  }
+
+  // Schedules every task with the same delay under one lock acquisition.
+  void scheduleBatch(std::vector<Task>& tasks, std::size_t delay_ms) {
+    bool rearm = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto now = Clock::now();
+      for (auto& task : tasks) {
+        const auto handle = queue_.insert(std::move(task), delay_ms, now);
+        rearm = rearm || queue_.deadline(handle) < armed_;
+      }
+      stats_.scheduled += tasks.size();
+    }
+    tasks.clear();
+    if (rearm) {
+      wake_.notify_one();
+    }
+  }
+
+  // Returns false when the timer already fired or was cancelled.
+  auto cancel(const Handle& handle) -> bool {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const bool cancelled = queue_.cancel(handle);
+    stats_.cancelled += cancelled ? 1 : 0;
+    if (cancelled) {
+      recordStatsCancellation();
+    }
+    return cancelled;
+  }
+
+  // Hands every expired batch to `executor` through one postBatch() call
+  // instead of running the tasks on the timer thread.
+  template <typename BatchExecutor>
+  void dispatchTo(BatchExecutor& executor) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dispatch_ = [&executor](std::vector<Task>& due) {
+      executor.postBatch(due.begin(), due.end());
+    };
+  }
+
+  [[nodiscard]] auto scheduler() -> SchedulerFunction {
+    return [this](std::function<void()> task, std::size_t delay_ms) {
+      schedule(std::move(task), delay_ms);
+    };
+  }
+
+  [[nodiscard]] auto stats() const -> TimerStats {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  [[nodiscard]] auto pending() const -> std::size_t {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+  }
+
+  // Memory held by the timer queue, see the queue's bytes().
+  [[nodiscard]] auto pendingBytes() const -> std::size_t {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.bytes();
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  Queue queue_;
+  std::function<void(std::vector<Task>&)> dispatch_;
+  TimerStats stats_;
+  // What the timer thread is waiting for; min() while it is not waiting.
+  typename Clock::time_point armed_ = Clock::time_point::min();
+  bool stopping_ = false;
+  std::thread thread_;
+
+  void run() {
+    std::vector<Task> due;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+      const auto slots = queue_.expire(Clock::now(), due);
+      if (!due.empty()) {
+        stats_.slots_expired += slots;
+        stats_.fired += due.size();
+        auto dispatch = dispatch_;
+        lock.unlock();
+        if (dispatch) {
+          dispatch(due);
+        } else {
+          for (auto& task : due) {
+            task();
+          }
+        }
+        due.clear();
+        lock.lock();
+        continue;
+      }
+      if (auto next = queue_.nextExpiry()) {
+        armed_ = *next;
+        wake_.wait_until(lock, *next);
+      } else {
+        armed_ = Clock::time_point::max();
+        wake_.wait(lock);
+      }
+      armed_ = Clock::time_point::min();
+      ++stats_.wakeups;
+    }
+  }
+};
+
+using TimerScheduler = BasicTimerScheduler<CoalescingTimerQueue>;
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef WORKSPACES_CPP20_TOPOLOGY_HPP
+#define WORKSPACES_CPP20_TOPOLOGY_HPP
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace async_chain {
+
+// CPUs this process may run on, grouped by NUMA node. Machines without NUMA
+// information (or non-Linux hosts) report a single node.
+struct CpuTopology {
+  std::vector<std::vector<int>> nodes;
+
+  [[nodiscard]] auto nodeOf(int cpu) const -> std::size_t {
+    for (std::size_t node = 0; node < nodes.size(); ++node) {
+      if (std::find(nodes[node].begin(), nodes[node].end(), cpu) !=
+          nodes[node].end()) {
+        return node;
+      }
+    }
+    return 0;
+  }
+
+  [[nodiscard]] auto cpuCount() const -> std::size_t {
+    std::size_t count = 0;
+    for (const auto& cpus : nodes) {
+      count += cpus.size();
+    }
+    return count;
+  }
+};
+
+// Parses the kernel's cpulist format, e.g. "0-3,8,10-11".
+inline auto parseCpuList(const std::string& text) -> std::vector<int> {
+  std::vector<int> cpus;
+  std::stringstream stream(text);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    const auto dash = range.find('-');
+    const int first = std::stoi(range.substr(0, dash));
+    const int last =
+        dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+inline auto cpuTopology() -> CpuTopology {
+  std::vector<int> allowed;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        allowed.push_back(cpu);
+      }
+    }
+  }
+#endif
+  if (allowed.empty()) {
+    const auto count = std::max(1U, std::thread::hardware_concurrency());
+    for (unsigned cpu = 0; cpu < count; ++cpu) {
+      allowed.push_back(static_cast<int>(cpu));
+    }
+  }
+
+  CpuTopology topology;
+#if defined(__linux__)
+  for (int node = 0;; ++node) {
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node) + "/cpulist");
+    if (!file) {
+      break;
+    }
+    std::string line;
+    std::getline(file, line);
+    std::vector<int> cpus;
+    for (int cpu : parseCpuList(line)) {
+      if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+        cpus.push_back(cpu);
+      }
+    }
+    if (!cpus.empty()) {
+      topology.nodes.push_back(std::move(cpus));
+    }
+  }
+#endif
+  if (topology.nodes.empty()) {
+    topology.nodes.push_back(std::move(allowed));
+  }
+  return topology;
+}
+
+// Pins the calling thread to one CPU; returns false where unsupported.
+inline auto pinCurrentThread(int cpu) -> bool {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+}  // namespace async_chain
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef WORKSPACES_CPP20_TRACE_HPP
+#define WORKSPACES_CPP20_TRACE_HPP
+
+#pragma once
+
+// USDT (statically defined) tracepoints for perf and bpftrace, e.g.
+//
+//   bpftrace -e 'usdt:./app:async_chain:step_end { @[arg0] = count(); }'
+//   perf buildid-cache --add ./app && perf list sdt_async_chain:*
+//
+// Each probe is one nop plus an ELF note describing where its arguments live;
+// until a tracer is attached nothing else runs. <sys/sdt.h> is used when
+// present, otherwise the bundled definition below emits the same note.
+// Define ASYNC_CHAIN_USDT=0 to compile the probes out.
+//
+// Probes (provider async_chain), every argument a 64-bit integer:
+//   step_start(kind, step)            holder about to call a step
+//   step_end(kind, step, is_err)      step called its continuation
+//   retry(kind, step, attempt)        retrying a step, attempt >= 1
+//   catch(step)                       catcher called with an error
+//   scheduler_post(step, delay_ms)    delayed retry handed to the scheduler
+//   chain_done(is_err)                final callback about to run
+// kind: 0 then, 1 catchError, 2 thenWithRetry, 3 thenWithRetryDelayed,
+// 4 thenSpeculative (both the validation and the fetch), 5 Dag node (step is
+// the node id), 6 retryGroup, 7 retryGroupDelayed (retry names the group's
+// first step), 8 a step of a thenIf/thenSwitch branch, 9 an iteration of
+// thenRepeatUntil/thenRepeatN.
+
+#include <cstdint>
+#include <type_traits>
+
+#if !defined(ASYNC_CHAIN_USDT)
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define ASYNC_CHAIN_USDT 1
+#else
+#define ASYNC_CHAIN_USDT 0
+#endif
+#endif
+
+#if ASYNC_CHAIN_USDT && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ASYNC_CHAIN_HAVE_SYS_SDT 1
+#endif
+#endif
+
+namespace async_chain::detail {
+
+enum class TraceKind : std::int64_t {
+  kThen = 0,
+  kCatch = 1,
+  kRetry = 2,
+  kRetryDelayed = 3,
+  kSpeculative = 4,
+  kDagNode = 5,
+  kRetryGroup = 6,
+  kRetryGroupDelayed = 7,
+  kBranch = 8,
+  kRepeat = 9,
+};
+
+template <typename T>
+inline auto traceArg(T value) -> std::int64_t {
+  if constexpr (std::is_pointer_v<T>) {
+    return static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(value));
+  } else {
+    return static_cast<std::int64_t>(value);
+  }
+}
+
+// True while a constexpr chain is evaluated at compile time, where probes are
+// skipped; false where the compiler cannot tell.
+constexpr auto constantEvaluated() -> bool {
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+  return __builtin_is_constant_evaluated();
+#else
+  return false;
+#endif
+#else
+  return false;
+#endif
+}
+
+}  // namespace async_chain::detail
+
+// Inline asm cannot run in a constant expression, so a probe sits in a
+// lambda that constant evaluation skips; at run time it inlines to the nop.
+#define ASYNC_CHAIN_RUNTIME_PROBE(probe)                             \
+  (::async_chain::detail::constantEvaluated() ? static_cast<void>(0) \
+                                              : [&] { probe; }())
+
+#if !ASYNC_CHAIN_USDT
+
+#define ASYNC_CHAIN_PROBE1(name, a) ((void)(a))
+#define ASYNC_CHAIN_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define ASYNC_CHAIN_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+
+#elif defined(ASYNC_CHAIN_HAVE_SYS_SDT)
+
+#define ASYNC_CHAIN_PROBE1(name, a) \
+  ASYNC_CHAIN_RUNTIME_PROBE(         \
+      STAP_PROBE1(async_chain, name, ::async_chain::detail::traceArg(a)))
+#define ASYNC_CHAIN_PROBE2(name, a, b)                                   \
+  ASYNC_CHAIN_RUNTIME_PROBE(                                             \
+      STAP_PROBE2(async_chain, name, ::async_chain::detail::traceArg(a), \
+                  ::async_chain::detail::traceArg(b)))
+#define ASYNC_CHAIN_PROBE3(name, a, b, c)                                \
+  ASYNC_CHAIN_RUNTIME_PROBE(                                             \
+      STAP_PROBE3(async_chain, name, ::async_chain::detail::traceArg(a), \
+                  ::async_chain::detail::traceArg(b),                    \
+                  ::async_chain::detail::traceArg(c)))
+
+#else
+
+// The note layout is the one <sys/sdt.h> emits (version 3): probe address,
+// base address for prelink adjustment, semaphore address (none), provider,
+// name and "size@location" per argument.
+#define ASYNC_CHAIN_SDT_ASM(name, args)                                    \
+  "990: nop\n"                                                             \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                            \
+  ".balign 4\n"                                                            \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                       \
+  "991: .asciz \"stapsdt\"\n"                                              \
+  "992: .balign 4\n"                                                       \
+  "993: .8byte 990b\n"                                                     \
+  ".8byte _.stapsdt.base\n"                                                \
+  ".8byte 0\n"                                                             \
+  ".asciz \"async_chain\"\n"                                               \
+  ".asciz \"" #name "\"\n"                                                 \
+  ".asciz \"" args "\"\n"                                                  \
+  "994: .balign 4\n"                                                       \
+  ".popsection\n"                                                          \
+  ".ifndef _.stapsdt.base\n"                                               \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n"                                                 \
+  ".hidden _.stapsdt.base\n"                                               \
+  "_.stapsdt.base: .space 1\n"                                             \
+  ".size _.stapsdt.base, 1\n"                                              \
+  ".popsection\n"                                                          \
+  ".endif\n"
+
+// GCC sizes inline asm by its line count when deciding what to inline; the
+// note is twenty lines but the code is one nop, so say so where supported.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 9
+#define ASYNC_CHAIN_ASM_INLINE inline
+#else
+#define ASYNC_CHAIN_ASM_INLINE
+#endif
+
+#define ASYNC_CHAIN_PROBE1(name, a)                          \
+  ASYNC_CHAIN_RUNTIME_PROBE(                                 \
+      __asm__ __volatile__ ASYNC_CHAIN_ASM_INLINE(           \
+          ASYNC_CHAIN_SDT_ASM(name, "-8@%0")                 \
+          :                                                  \
+          : "nor"(::async_chain::detail::traceArg(a))))
+#define ASYNC_CHAIN_PROBE2(name, a, b)                       \
+  ASYNC_CHAIN_RUNTIME_PROBE(                                 \
+      __asm__ __volatile__ ASYNC_CHAIN_ASM_INLINE(           \
+          ASYNC_CHAIN_SDT_ASM(name, "-8@%0 -8@%1")           \
+          :                                                  \
+          : "nor"(::async_chain::detail::traceArg(a)),       \
+            "nor"(::async_chain::detail::traceArg(b))))
+#define ASYNC_CHAIN_PROBE3(name, a, b, c)                    \
+  ASYNC_CHAIN_RUNTIME_PROBE(                                 \
+      __asm__ __volatile__ ASYNC_CHAIN_ASM_INLINE(           \
+          ASYNC_CHAIN_SDT_ASM(name, "-8@%0 -8@%1 -8@%2")     \
+          :                                                  \
+          : "nor"(::async_chain::detail::traceArg(a)),       \
+            "nor"(::async_chain::detail::traceArg(b)),       \
+            "nor"(::async_chain::detail::traceArg(c))))
+
+#endif
+
+#endif
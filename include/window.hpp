@@ -0,0 +1,290 @@
+#ifndef WORKSPACES_CPP20_WINDOW_HPP
+#define WORKSPACES_CPP20_WINDOW_HPP
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "async.hpp"
+#include "thread_slot.hpp"
+
+namespace async_chain {
+
+// Window boundaries. A window is made of panes of `slide` milliseconds or
+// items and covers the last size / slide of them; a tumbling window is one
+// pane. Sliding windows emit every pane, the first ones covering fewer
+// panes until enough have closed.
+struct WindowSpec {
+  enum class Kind { kTime, kCount };
+
+  Kind kind = Kind::kCount;
+  std::size_t size = 1;
+  std::size_t slide = 1;
+
+  static auto tumbling(std::chrono::milliseconds width) -> WindowSpec {
+    return sliding(width, width);
+  }
+
+  static auto sliding(std::chrono::milliseconds width,
+                      std::chrono::milliseconds every) -> WindowSpec {
+    return WindowSpec{Kind::kTime, static_cast<std::size_t>(width.count()),
+                      static_cast<std::size_t>(every.count())};
+  }
+
+  static auto count(std::size_t items) -> WindowSpec {
+    return countSliding(items, items);
+  }
+
+  static auto countSliding(std::size_t items, std::size_t every)
+      -> WindowSpec {
+    return WindowSpec{Kind::kCount, items, every};
+  }
+};
+
+template <typename Acc>
+struct Window {
+  // Index of the window's last pane; panes are numbered from 0.
+  std::size_t index = 0;
+  std::size_t items = 0;
+  std::size_t errors = 0;
+  Acc value{};
+};
+
+// Streaming aggregation of chain results into windows. Each thread adds
+// into its own partial aggregate; the partials are merged when a pane
+// closes, and `on_window` receives one Result per window: Ok with the merged
+// value and item counts, or the first error when every item in the window
+// failed.
+//
+// Adding takes no lock. Panes are numbered by an epoch, and each thread's
+// shard keeps the partials of two of them: a writer publishes the epoch it
+// adds into, and closing a pane advances the epoch and waits only for
+// writers still inside the old one. Time windows close on the scheduler
+// (global_scheduler unless given); a scheduler that runs tasks inline cannot
+// wait, so on one they close only on flush(). Count windows are closed by
+// the thread that adds a pane's last item, and items that race with that
+// close land in the next pane. `on_window` runs without any lock held and
+// may add() or flush(); windows closed concurrently may reach it out of
+// index order.
+//
+// `accumulate(acc, item)` folds a value into a partial, `merge(into, part)`
+// folds one partial into another; Acc must be default-constructible and
+// copyable. The aggregator is a chain step that passes its input on:
+//
+//   WindowedAggregator<int, long> sums(
+//       WindowSpec::tumbling(1s), [](long& s, int v) { s += v; },
+//       [](long& s, long part) { s += part; }, publish);
+//   initAsyncChain<int, std::string>().then(work).then(sums).finally(done);
+template <typename In, typename Acc, typename E = std::string>
+class WindowedAggregator {
+ public:
+  using Accumulate = std::function<void(Acc&, const In&)>;
+  using Merge = std::function<void(Acc&, const Acc&)>;
+  using OnWindow = std::function<void(Result<Window<Acc>, E>)>;
+
+  // Throws std::invalid_argument unless size is a non-zero multiple of
+  // slide.
+  WindowedAggregator(WindowSpec spec, Accumulate accumulate, Merge merge,
+                     OnWindow on_window,
+                     SchedulerFunction scheduler = global_scheduler)
+      : state_(std::make_shared<State>(spec, std::move(accumulate),
+                                       std::move(merge),
+                                       std::move(on_window))) {
+    if (spec.slide == 0 || spec.size == 0 || spec.size % spec.slide != 0) {
+      throw std::invalid_argument(
+          "WindowedAggregator: size must be a multiple of slide");
+    }
+    if (spec.kind == WindowSpec::Kind::kTime) {
+      arm(state_, std::move(scheduler));
+    }
+  }
+
+  WindowedAggregator(const WindowedAggregator&) = delete;
+  auto operator=(const WindowedAggregator&) -> WindowedAggregator& = delete;
+
+  // A pending timer finds the state stopped and does not re-arm.
+  ~WindowedAggregator() {
+    state_->stopped.store(true, std::memory_order_release);
+  }
+
+  void add(const Result<In, E>& item) {
+    auto& state = *state_;
+    auto& shard = localShard();
+    std::uint64_t epoch = 0;
+    do {
+      epoch = state.epoch.load(std::memory_order_seq_cst);
+      shard.active.store(epoch, std::memory_order_seq_cst);
+    } while (state.epoch.load(std::memory_order_seq_cst) != epoch);
+    auto& pane = shard.panes[epoch & 1];
+    if (item.is_err()) {
+      if (pane.errors++ == 0) {
+        pane.error = *item.error;
+      }
+    } else {
+      state.accumulate(pane.value, *item.value);
+      ++pane.items;
+    }
+    shard.active.store(kIdle, std::memory_order_release);
+    if (state.spec.kind == WindowSpec::Kind::kCount &&
+        (state.added.fetch_add(1, std::memory_order_relaxed) + 1) %
+                state.spec.slide ==
+            0) {
+      close(state);
+    }
+  }
+
+  template <typename Next>
+  void operator()(Next next, Result<In, E> input) {
+    add(input);
+    next(std::move(input));
+  }
+
+  // Closes the current pane now, e.g. to emit the last partial window at
+  // shutdown.
+  void flush() { close(*state_); }
+
+ private:
+  static constexpr std::uint64_t kIdle =
+      std::numeric_limits<std::uint64_t>::max();
+
+  struct Pane {
+    Acc value{};
+    std::size_t items = 0;
+    std::size_t errors = 0;
+    std::optional<E> error;
+  };
+
+  struct Shard {
+    Shard* next = nullptr;
+    std::atomic<std::uint64_t> active{kIdle};
+    Pane panes[2];
+  };
+
+  struct State {
+    WindowSpec spec;
+    Accumulate accumulate;
+    Merge merge;
+    OnWindow on_window;
+    detail::ThreadSlotKey shard_key;
+    std::atomic<std::uint64_t> epoch{0};
+    std::atomic<std::uint64_t> added{0};
+    std::atomic<Shard*> shards{nullptr};
+    std::atomic<bool> stopped{false};
+    // Thread inside the scheduler call arming the timer, if any; the timer
+    // runs on it only when the scheduler runs tasks inline.
+    std::atomic<std::thread::id> arming{};
+    // Closed panes still covered by the next window; used by close() only.
+    std::mutex close_mutex;
+    std::deque<Pane> recent;
+
+    State(WindowSpec s, Accumulate a, Merge m, OnWindow w)
+        : spec(s),
+          accumulate(std::move(a)),
+          merge(std::move(m)),
+          on_window(std::move(w)) {}
+
+    State(const State&) = delete;
+    auto operator=(const State&) -> State& = delete;
+
+    ~State() {
+      for (auto* shard = shards.load(); shard != nullptr;) {
+        delete std::exchange(shard, shard->next);
+      }
+    }
+  };
+
+  std::shared_ptr<State> state_;
+
+  auto localShard() -> Shard& {
+    auto& slot = detail::threadSlot(state_->shard_key);
+    if (slot == nullptr) {
+      auto* shard = new Shard;
+      shard->next = state_->shards.load(std::memory_order_relaxed);
+      while (!state_->shards.compare_exchange_weak(shard->next, shard)) {
+      }
+      slot = shard;
+    }
+    return *static_cast<Shard*>(slot);
+  }
+
+  static void arm(const std::shared_ptr<State>& state,
+                  SchedulerFunction scheduler) {
+    const auto every = state->spec.slide;
+    auto again = scheduler;
+    state->arming.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    scheduler(
+        [weak = std::weak_ptr<State>(state), again = std::move(again)] {
+          auto state = weak.lock();
+          // Re-arming from an inline run would close panes forever.
+          if (state && !state->stopped.load(std::memory_order_acquire) &&
+              state->arming.load(std::memory_order_relaxed) !=
+                  std::this_thread::get_id()) {
+            close(*state);
+            arm(state, again);
+          }
+        },
+        every);
+    state->arming.store(std::thread::id(), std::memory_order_relaxed);
+  }
+
+  // Shards pushed after the epoch advanced are seen by their writers'
+  // epoch load, so a writer of the closing pane is always on the list.
+  static void close(State& state) {
+    std::unique_lock<std::mutex> lock(state.close_mutex);
+    const auto epoch = state.epoch.fetch_add(1, std::memory_order_seq_cst);
+    Pane closed;
+    for (auto* shard = state.shards.load(std::memory_order_seq_cst);
+         shard != nullptr; shard = shard->next) {
+      while (shard->active.load(std::memory_order_seq_cst) == epoch) {
+        std::this_thread::yield();
+      }
+      auto& part = shard->panes[epoch & 1];
+      fold(state, closed, part);
+      part = Pane{};
+    }
+    state.recent.push_back(std::move(closed));
+    if (state.recent.size() > state.spec.size / state.spec.slide) {
+      state.recent.pop_front();
+    }
+    Pane window;
+    for (const auto& pane : state.recent) {
+      fold(state, window, pane);
+    }
+    using Out = Result<Window<Acc>, E>;
+    auto out = window.items == 0 && window.error
+                   ? Out::Err(std::move(*window.error))
+                   : Out::Ok(Window<Acc>{static_cast<std::size_t>(epoch),
+                                         window.items, window.errors,
+                                         std::move(window.value)});
+    lock.unlock();
+    state.on_window(std::move(out));
+  }
+
+  static void fold(State& state, Pane& into, const Pane& part) {
+    if (part.items > 0) {
+      state.merge(into.value, part.value);
+    }
+    into.items += part.items;
+    into.errors += part.errors;
+    if (!into.error && part.error) {
+      into.error = part.error;
+    }
+  }
+};
+
+}  // namespace async_chain
+
+#endif
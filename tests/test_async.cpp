@@ -1,11 +1,40 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #include "include/async.hpp"
+#include "include/checkpoint.hpp"
+#include "include/dag.hpp"
+#include "include/debounce.hpp"
+#include "include/executor.hpp"
+#include "include/generator.hpp"
+#include "include/pool.hpp"
+#include "include/prometheus.hpp"
+#include "include/timer.hpp"
+#include "include/window.hpp"
 
 using namespace async_chain;
 
@@ -436,4 +465,1361 @@ TEST(AsyncChainDemo, DeeplyNestedMultiLevelChain) {
   initAsyncChain<std::string, std::string>().then(step1).finally(finalStep);
   EXPECT_TRUE(final_ok);
   EXPECT_EQ(final_result, "deep value");
-}
\ No newline at end of file
+}
+
+// Blocks the executor's only worker until released, so the test can queue up
+// work for several tenants before dispatch starts.
+static auto blockWorker(Executor& executor) -> std::promise<void> {
+  std::promise<void> gate;
+  auto opened = gate.get_future().share();
+  executor.post(99, [opened] { opened.wait(); });
+  return gate;
+}
+
+TEST(AsyncChainTest, SpeculativeFetchCommitsOrReruns) {
+  using MyResult = Result<int, std::string>;
+  std::vector<int> fetched;
+  std::function<void(MyResult)> finish_validation;
+  auto source = [](auto next, MyResult) { next(MyResult::Ok(7)); };
+  auto validate = [&finish_validation](auto next, MyResult) {
+    finish_validation = std::move(next);
+  };
+  auto fetch = [&fetched](auto next, MyResult result) {
+    fetched.push_back(*result.value);
+    next(MyResult::Ok(*result.value * 10));
+  };
+
+  auto run = [&](MyResult verdict) {
+    fetched.clear();
+    std::optional<MyResult> out;
+    initAsyncChain<int, std::string>()
+        .then(source)
+        .thenSpeculative(validate, fetch)
+        .finally([&out](MyResult result) { out = result; });
+    // The fetch has already run on the predicted value.
+    EXPECT_EQ(fetched, std::vector<int>{7});
+    EXPECT_FALSE(out.has_value());
+    finish_validation(verdict);
+    EXPECT_TRUE(out.has_value());
+    return out.value_or(MyResult::Err("no result"));
+  };
+
+  const auto before = collectStats();
+  auto committed = run(MyResult::Ok(7));
+  EXPECT_EQ(*committed.value, 70);
+  EXPECT_EQ(fetched, std::vector<int>{7});
+
+  auto rerun = run(MyResult::Ok(8));
+  EXPECT_EQ(*rerun.value, 80);
+  EXPECT_EQ(fetched, (std::vector<int>{7, 8}));
+
+  auto discarded = run(MyResult::Err("stale"));
+  EXPECT_EQ(*discarded.error, "stale");
+  EXPECT_EQ(fetched, std::vector<int>{7});
+
+  const auto after = collectStats();
+  for (std::size_t o = 0; o < kStatsSpeculationOutcomes; ++o) {
+    EXPECT_EQ(after.speculations[o] - before.speculations[o], 1U);
+  }
+}
+
+TEST(AsyncChainTest, RetryGroupReplaysOnlyTheGroupFromItsInput) {
+  using MyResult = Result<int, std::string>;
+  int prefix_calls = 0;
+  std::vector<int> acquire_inputs;
+  int verify_calls = 0;
+  int failures_left = 0;
+  auto prefix = [&prefix_calls](auto next, MyResult) {
+    ++prefix_calls;
+    next(MyResult::Ok(10));
+  };
+  auto acquire = [&acquire_inputs](auto next, MyResult result) {
+    acquire_inputs.push_back(*result.value);
+    next(MyResult::Ok(*result.value + 1));
+  };
+  auto call = [](auto next, MyResult result) {
+    next(MyResult::Ok(*result.value * 2));
+  };
+  auto verify = [&](auto next, MyResult result) {
+    ++verify_calls;
+    next(failures_left-- > 0 ? MyResult::Err("stale token") : result);
+  };
+
+  std::vector<std::size_t> delays;
+  setScheduler([&delays](const std::function<void()>& task,
+                         std::size_t delay_ms) {
+    delays.push_back(delay_ms);
+    task();
+  });
+
+  std::optional<MyResult> out;
+  failures_left = 2;
+  initAsyncChain<int, std::string>()
+      .then(prefix)
+      .retryGroup<2>(acquire, call, verify)
+      .finally([&out](MyResult result) { out = result; });
+  ASSERT_TRUE(out.has_value());
+  EXPECT_EQ(*out->value, 22);
+  EXPECT_EQ(prefix_calls, 1);
+  EXPECT_EQ(acquire_inputs, (std::vector<int>{10, 10, 10}));
+  EXPECT_TRUE(delays.empty());
+
+  acquire_inputs.clear();
+  verify_calls = 0;
+  failures_left = 5;
+  initAsyncChain<int, std::string>()
+      .then(prefix)
+      .retryGroupDelayed<1, 25>(acquire, call, verify)
+      .finally([&out](MyResult result) { out = result; });
+  setScheduler([](const std::function<void()>& task, std::size_t) { task(); });
+  EXPECT_EQ(*out->error, "stale token");
+  EXPECT_EQ(verify_calls, 2);
+  EXPECT_EQ(acquire_inputs, (std::vector<int>{10, 10}));
+  EXPECT_EQ(delays, std::vector<std::size_t>{25});
+}
+
+// A pure chain over literal types, usable in constant expressions.
+struct BlockParams {
+  int block;
+  int shift;
+};
+
+constexpr auto blockParams(int block) -> Result<BlockParams, int> {
+  using R = Result<BlockParams, int>;
+  auto load = [block](auto next, R /*input*/) {
+    next(block > 0 ? R::Ok(BlockParams{block, 0}) : R::Err(block));
+  };
+  auto shift = [](auto next, R input) {
+    auto params = *input.value;
+    while ((1 << params.shift) < params.block) {
+      ++params.shift;
+    }
+    next(R::Ok(params));
+  };
+  auto fallback = [](auto next, R /*error*/) {
+    next(R::Ok(BlockParams{4096, 12}));
+  };
+  auto flaky = [calls = 0](auto next, std::size_t attempt) mutable {
+    ++calls;
+    next(attempt < 1 ? R::Err(calls) : R::Ok(BlockParams{calls, 0}));
+  };
+  return initAsyncChain<BlockParams, int>()
+      .then(load)
+      .then(shift)
+      .catchError(fallback)
+      .thenWithRetry<2>(flaky)
+      .then(shift)
+      .evaluate();
+}
+
+TEST(AsyncChainTest, EvaluatesPureChainsInConstantExpressions) {
+  constexpr auto kTuned = blockParams(1000);
+  static_assert(kTuned.is_ok() && kTuned.value->block == 2 &&
+                kTuned.value->shift == 1);
+  constexpr auto kRecovered = blockParams(-1);
+  static_assert(kRecovered.value->shift == 1);
+
+  // The same chain at run time, where the stats and probes are live.
+  const auto tuned = blockParams(1000);
+  EXPECT_EQ(tuned.value->block, kTuned.value->block);
+
+  std::function<void(Result<int, std::string>)> parked;
+  auto park = [&parked](auto next, auto /*input*/) { parked = next; };
+  auto unfinished = [&park] {
+    return initAsyncChain<int, std::string>().then(park).evaluate();
+  };
+  EXPECT_THROW(unfinished(), std::logic_error);
+}
+
+enum class Route { kCache, kDatabase, kRemote };
+
+TEST(AsyncChainTest, BranchesRunOnlyTheSelectedSteps) {
+  using MyResult = Result<int, std::string>;
+  std::vector<std::string> ran;
+  auto step = [&ran](std::string name, int add) {
+    return [&ran, name, add](auto next, MyResult input) {
+      ran.push_back(name);
+      next(MyResult::Ok(*input.value + add));
+    };
+  };
+  auto seed = [](auto next, MyResult /*input*/) { next(MyResult::Ok(5)); };
+  auto double_it = step("double", 5);
+  auto plus_one = step("plus_one", 1);
+  auto minus_one = step("minus_one", -1);
+  auto is_small = [](const MyResult& result) { return *result.value < 10; };
+
+  int value = 0;
+  initAsyncChain<int, std::string>()
+      .then(seed)
+      .thenIf(is_small, branch(double_it, plus_one), minus_one)
+      .thenIf(is_small, plus_one)
+      .finally([&value](MyResult result) { value = *result.value; });
+  EXPECT_EQ(value, 11);
+  EXPECT_EQ(ran, (std::vector<std::string>{"double", "plus_one"}));
+
+  // Selected by enum; an index without a branch passes the result on. The
+  // branch's second step runs after the first completes asynchronously.
+  std::function<void(MyResult)> parked;
+  auto remote = [&parked](auto next, MyResult /*input*/) { parked = next; };
+  auto fail = [](auto next, MyResult /*input*/) {
+    next(MyResult::Err("miss"));
+  };
+  Route route = Route::kRemote;
+  auto pick = [&route](const MyResult& /*result*/) { return route; };
+  std::vector<MyResult> results;
+  auto run = [&] {
+    ran.clear();
+    initAsyncChain<int, std::string>()
+        .then(seed)
+        .thenSwitch(pick, branch(fail, plus_one), minus_one,
+                    branch(remote, plus_one))
+        .finally([&results](MyResult result) { results.push_back(result); });
+  };
+  run();
+  ASSERT_TRUE(results.empty());
+  parked(MyResult::Ok(40));
+  route = Route::kCache;
+  run();
+  route = Route::kDatabase;
+  run();
+  route = static_cast<Route>(7);
+  run();
+  ASSERT_EQ(results.size(), 4U);
+  EXPECT_EQ(*results[0].value, 41);
+  EXPECT_EQ(*results[1].error, "miss");
+  EXPECT_EQ(*results[2].value, 4);
+  EXPECT_EQ(*results[3].value, 5);
+  EXPECT_TRUE(ran.empty());
+
+  // Every branch's step pointers are in the frame, and nothing else.
+  using Plan = decltype(initAsyncChain<int, std::string>().thenSwitch(
+      pick, branch(fail, plus_one), minus_one));
+  static_assert(Plan::kFrameBytes ==
+                sizeof(void*) + 3 * sizeof(decltype(plus_one)*));
+
+  static_assert(*[] {
+    auto seven = [](auto next, Result<int, int> /*input*/) {
+      next(Result<int, int>::Ok(7));
+    };
+    auto odd = [](const Result<int, int>& result) {
+      return *result.value % 2 != 0;
+    };
+    auto triple = [](auto next, Result<int, int> input) {
+      next(Result<int, int>::Ok(*input.value * 3));
+    };
+    return initAsyncChain<int, int>()
+        .then(seven)
+        .thenIf(odd, triple)
+        .evaluate();
+  }().value == 21);
+}
+
+TEST(AsyncChainTest, RepeatLoopsInPlaceUntilDone) {
+  using MyResult = Result<int, std::string>;
+  // A million synchronous iterations would overflow the stack if nested.
+  auto next_page = [](auto next, MyResult cursor) {
+    next(MyResult::Ok(*cursor.value + 1));
+  };
+  auto last_page = [](const MyResult& cursor) {
+    return *cursor.value == 1000000;
+  };
+  int cursor = 0;
+  initAsyncChain<int, std::string>()
+      .thenRepeatUntil(last_page, next_page)
+      .thenRepeatN(5, next_page)
+      .thenRepeatN(0, next_page)
+      .finally([&cursor](MyResult result) { cursor = *result.value; });
+  EXPECT_EQ(cursor, 1000005);
+
+  // Asynchronous iterations, mixed with synchronous ones, and an error that
+  // ends the loop early.
+  std::function<void(MyResult)> parked;
+  int calls = 0;
+  auto sometimes_async = [&](auto next, MyResult input) {
+    ++calls;
+    if (*input.value == 3) {
+      next(MyResult::Err("gone"));
+    } else if (*input.value % 2 == 0) {
+      parked = [next, value = *input.value](MyResult) mutable {
+        next(MyResult::Ok(value + 1));
+      };
+    } else {
+      next(MyResult::Ok(*input.value + 1));
+    }
+  };
+  std::vector<MyResult> results;
+  initAsyncChain<int, std::string>()
+      .thenRepeatN(5, sometimes_async)
+      .finally([&results](MyResult result) { results.push_back(result); });
+  ASSERT_TRUE(results.empty());
+  auto resume = std::move(parked);
+  resume(MyResult::Ok(0));
+  ASSERT_TRUE(parked);
+  std::move(parked)(MyResult::Ok(0));
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(*results[0].error, "gone");
+  EXPECT_EQ(calls, 4);
+
+  // Polling waits on the scheduler between iterations.
+  std::vector<std::size_t> delays;
+  setScheduler([&delays](const std::function<void()>& task,
+                         std::size_t delay_ms) {
+    delays.push_back(delay_ms);
+    task();
+  });
+  auto ready = [](const MyResult& polls) { return *polls.value >= 3; };
+  initAsyncChain<int, std::string>()
+      .thenRepeatUntilDelayed<20>(ready, next_page)
+      .finally([&cursor](MyResult result) { cursor = *result.value; });
+  setScheduler([](const std::function<void()>& task, std::size_t) { task(); });
+  EXPECT_EQ(cursor, 3);
+  EXPECT_EQ(delays, (std::vector<std::size_t>{20, 20}));
+}
+
+// Runs prefix -> checkpoint -> flaky twice: the first execution fails after
+// the checkpoint, the second resumes from it.
+template <typename Store, typename OpenStore>
+static void checkResumeFromCheckpoint(Store& first_store,
+                                      OpenStore open_store) {
+  using MyResult = Result<int, std::string>;
+  int prefix_calls = 0;
+  bool fail = true;
+  auto expensive = [&prefix_calls](auto next, MyResult) {
+    ++prefix_calls;
+    next(MyResult::Ok(41));
+  };
+  auto flaky = [&fail](auto next, MyResult result) {
+    next(fail ? MyResult::Err("transient") : MyResult::Ok(*result.value + 1));
+  };
+  std::optional<MyResult> out;
+  auto done = [&out](MyResult result) { out = result; };
+
+  initAsyncChain<int, std::string>()
+      .then(expensive)
+      .checkpoint(first_store)
+      .then(flaky)
+      .finally(done);
+  EXPECT_EQ(*out->error, "transient");
+
+  auto store = open_store();
+  auto saved = store->load();
+  ASSERT_TRUE(saved.has_value());
+  EXPECT_EQ(saved->index, 1U);
+  EXPECT_EQ(*saved->result.value, 41);
+  fail = false;
+  initAsyncChain<int, std::string>()
+      .then(expensive)
+      .checkpoint(*store)
+      .then(flaky)
+      .resume(*saved, done);
+  EXPECT_EQ(*out->value, 42);
+  EXPECT_EQ(prefix_calls, 1);
+
+  store->clear();
+  EXPECT_FALSE(store->load().has_value());
+}
+
+TEST(CheckpointTest, ResumesAfterCheckpointWithoutRerunningPrefix) {
+  MemoryCheckpointStore<int, std::string> memory;
+  checkResumeFromCheckpoint(memory, [&memory] { return &memory; });
+
+  const auto path =
+      "/tmp/async_chain_checkpoint." + std::to_string(::getpid());
+  ::unlink(path.c_str());
+  {
+    MappedCheckpointStore<int, std::string> mapped(path);
+    // The second execution opens the file again, as a restarted process
+    // would.
+    checkResumeFromCheckpoint(mapped, [&path] {
+      return std::make_unique<MappedCheckpointStore<int, std::string>>(path);
+    });
+  }
+  ::unlink(path.c_str());
+
+  MemoryCheckpointStore<int, std::string> unused;
+  auto resume_past_end = [&unused] {
+    initAsyncChain<int, std::string>().checkpoint(unused).resume(
+        Checkpoint<int, std::string>{3, {}}, [](Result<int, std::string>) {});
+  };
+  EXPECT_THROW(resume_past_end(), std::out_of_range);
+}
+
+TEST(CheckpointTest, MappedStoreKeepsPreviousCheckpointWhenSaveIsCutShort) {
+  using MyResult = Result<std::string, std::string>;
+  using Store = MappedCheckpointStore<std::string, std::string>;
+  const auto path =
+      "/tmp/async_chain_checkpoint_slots." + std::to_string(::getpid());
+  ::unlink(path.c_str());
+  const std::string large(4096, 'x');
+  {
+    Store store(path);
+    store.save(1, MyResult::Ok("first"));
+    // Outgrows the file, which is remapped.
+    store.save(2, MyResult::Ok(large));
+  }
+  {
+    Store store(path);
+    const auto saved = store.load();
+    ASSERT_TRUE(saved.has_value());
+    EXPECT_EQ(saved->index, 2U);
+    EXPECT_EQ(*saved->result.value, large);
+  }
+
+  // Leave the file as a save of index 2 interrupted after it cleared its
+  // slot and wrote part of the payload.
+  const int fd = ::open(path.c_str(), O_RDWR);
+  ASSERT_GE(fd, 0);
+  struct stat info {};
+  ASSERT_EQ(::fstat(fd, &info), 0);
+  const auto size = static_cast<std::size_t>(info.st_size);
+  void* mapped =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  ASSERT_NE(mapped, MAP_FAILED);
+  auto* file = static_cast<CheckpointFileHeader*>(mapped);
+  for (auto& slot : file->slots) {
+    if (slot.index == 2) {
+      slot.generation.store(0);
+      std::memset(static_cast<char*>(mapped) + slot.offset, 'y', 16);
+    }
+  }
+  ::munmap(mapped, size);
+
+  Store store(path);
+  const auto saved = store.load();
+  ASSERT_TRUE(saved.has_value());
+  EXPECT_EQ(saved->index, 1U);
+  EXPECT_EQ(*saved->result.value, "first");
+  ::unlink(path.c_str());
+}
+
+TEST(GeneratorTest, PullsOnDemandWithReadahead) {
+  using MyResult = Result<int, std::string>;
+  int produced = 0;
+  auto counter = [&produced](int limit) {
+    return [&produced, limit, i = 0](auto emit) mutable {
+      ++produced;
+      emit(i < limit ? std::optional<MyResult>(MyResult::Ok(i++))
+                     : std::nullopt);
+    };
+  };
+
+  AsyncGenerator<int> numbers(counter(10), 2);
+  EXPECT_EQ(produced, 0);
+  std::optional<int> first;
+  numbers.next([&first](std::optional<MyResult> item) {
+    first = *item->value;
+  });
+  EXPECT_EQ(first, 0);
+  EXPECT_EQ(produced, 3);
+  EXPECT_EQ(numbers.buffered(), 2U);
+
+  // As a chain step over std::optional<int>.
+  std::optional<int> pulled;
+  initAsyncChain<std::optional<int>, std::string>().then(numbers).finally(
+      [&pulled](Result<std::optional<int>, std::string> result) {
+        pulled = **result.value;
+      });
+  EXPECT_EQ(pulled, 1);
+
+  // forEach keeps at most two items in flight.
+  std::vector<int> seen;
+  std::vector<std::function<void()>> pending;
+  bool ended = false;
+  numbers.forEach(
+      [&](MyResult item, std::function<void()> done) {
+        seen.push_back(*item.value);
+        pending.push_back(std::move(done));
+      },
+      2, [&ended] { ended = true; });
+  while (!pending.empty()) {
+    EXPECT_LE(pending.size(), 2U);
+    auto done = std::move(pending.front());
+    pending.erase(pending.begin());
+    done();
+  }
+  EXPECT_TRUE(ended);
+  EXPECT_EQ(seen, (std::vector<int>{2, 3, 4, 5, 6, 7, 8, 9}));
+
+  // Synchronous processing loops instead of nesting one frame per item.
+  AsyncGenerator<int> many(counter(1000000), 4);
+  long long sum = 0;
+  many.forEach(
+      [&sum](MyResult item, auto done) {
+        sum += *item.value;
+        done();
+      },
+      1, [] {});
+  EXPECT_EQ(sum, 499999500000LL);
+}
+
+TEST(WindowTest, AggregatesTumblingSlidingAndCountWindows) {
+  using Sums = Result<Window<long>, std::string>;
+  auto add = [](long& sum, const int& value) { sum += value; };
+  auto merge = [](long& sum, const long& part) { sum += part; };
+
+  // Count windows close on the thread that adds their last item.
+  std::vector<Sums> counted;
+  WindowedAggregator<int, long> per_three(
+      WindowSpec::count(3), add, merge,
+      [&counted](Sums window) { counted.push_back(std::move(window)); });
+  for (int i = 1; i <= 7; ++i) {
+    auto value = [i](auto next, auto /*input*/) {
+      next(Result<int, std::string>::Ok(i));
+    };
+    initAsyncChain<int, std::string>().then(value).then(per_three).finally(
+        [](auto /*result*/) {});
+  }
+  per_three.add(Result<int, std::string>::Err("lost"));
+  per_three.flush();
+  per_three.flush();
+  ASSERT_EQ(counted.size(), 4U);
+  EXPECT_EQ(counted[0].value->value, 1 + 2 + 3);
+  EXPECT_EQ(counted[1].value->value, 4 + 5 + 6);
+  EXPECT_EQ(counted[2].value->value, 7);
+  EXPECT_EQ(counted[2].value->errors, 1U);
+  EXPECT_EQ(counted[3].value->items, 0U);
+
+  // Time windows close on the scheduler's timers.
+  std::vector<std::function<void()>> timers;
+  SchedulerFunction manual = [&timers](std::function<void()> task,
+                                       std::size_t delay_ms) {
+    EXPECT_EQ(delay_ms, 10U);
+    timers.push_back(std::move(task));
+  };
+  auto tick = [&timers] {
+    auto task = std::move(timers.back());
+    timers.pop_back();
+    task();
+  };
+  std::vector<Sums> sliding;
+  {
+    WindowedAggregator<int, long> last_two(
+        WindowSpec::sliding(std::chrono::milliseconds(20),
+                            std::chrono::milliseconds(10)),
+        add, merge,
+        [&sliding](Sums window) { sliding.push_back(std::move(window)); },
+        manual);
+    for (int value : {1, 2}) {
+      last_two.add(Result<int, std::string>::Ok(value));
+    }
+    tick();
+    last_two.add(Result<int, std::string>::Ok(4));
+    tick();
+    last_two.add(Result<int, std::string>::Err("down"));
+    tick();
+    tick();
+    ASSERT_EQ(timers.size(), 1U);
+  }
+  // The destroyed aggregator's pending timer does not fire a window.
+  tick();
+  EXPECT_TRUE(timers.empty());
+  ASSERT_EQ(sliding.size(), 4U);
+  EXPECT_EQ(sliding[0].value->value, 3);
+  EXPECT_EQ(sliding[1].value->value, 7);
+  EXPECT_EQ(sliding[1].value->index, 1U);
+  EXPECT_EQ(sliding[2].value->value, 4);
+  EXPECT_EQ(sliding[2].value->errors, 1U);
+  ASSERT_TRUE(sliding[3].is_err());
+  EXPECT_EQ(*sliding[3].error, "down");
+
+  // An inline scheduler cannot wait, so time windows close on flush() only,
+  // and on_window may flush again without deadlocking.
+  std::vector<Sums> inline_windows;
+  {
+    WindowedAggregator<int, long>* self = nullptr;
+    WindowedAggregator<int, long> instant(
+        WindowSpec::tumbling(std::chrono::milliseconds(10)), add, merge,
+        [&inline_windows, &self](Sums window) {
+          inline_windows.push_back(std::move(window));
+          if (inline_windows.size() == 1) {
+            self->flush();
+          }
+        },
+        [](const std::function<void()>& task, std::size_t) { task(); });
+    self = &instant;
+    EXPECT_TRUE(inline_windows.empty());
+    instant.add(Result<int, std::string>::Ok(5));
+    instant.add(Result<int, std::string>::Ok(6));
+    instant.flush();
+  }
+  ASSERT_EQ(inline_windows.size(), 2U);
+  EXPECT_EQ(inline_windows[0].value->value, 11);
+  EXPECT_EQ(inline_windows[1].value->items, 0U);
+
+  // Concurrent adders: every item lands in exactly one window.
+  std::atomic<long> total{0};
+  std::atomic<std::size_t> items{0};
+  WindowedAggregator<int, long> shared(
+      WindowSpec::count(100), add, merge, [&](Sums window) {
+        total += window.value->value;
+        items += window.value->items;
+      });
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&shared] {
+      for (int i = 0; i < 10000; ++i) {
+        shared.add(Result<int, std::string>::Ok(1));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  shared.flush();
+  EXPECT_EQ(total.load(), 40000);
+  EXPECT_EQ(items.load(), 40000U);
+}
+
+TEST(DebounceTest, DebounceAndThrottleDropSupersededEvents) {
+  using namespace std::chrono_literals;
+  std::vector<std::function<void()>> timers;
+  std::vector<std::size_t> delays;
+  SchedulerFunction manual = [&](std::function<void()> task,
+                                 std::size_t delay_ms) {
+    timers.push_back(std::move(task));
+    delays.push_back(delay_ms);
+  };
+  auto tick = [&timers] {
+    auto task = std::move(timers.front());
+    timers.erase(timers.begin());
+    task();
+  };
+
+  // Each run starts a chain; superseded events never reach one.
+  std::vector<int> ran;
+  int chains = 0;
+  auto start = [&](int value) {
+    auto load = [value](auto next, auto /*input*/) {
+      next(Result<int, std::string>::Ok(value));
+    };
+    ++chains;
+    initAsyncChain<int, std::string>().then(load).finally(
+        [&ran](Result<int, std::string> result) {
+          ran.push_back(*result.value);
+        });
+  };
+
+  {
+    Debounce<int> debounce(50ms, start, manual);
+    for (int value : {1, 2, 3}) {
+      debounce.push(value);
+    }
+    ASSERT_EQ(timers.size(), 1U);
+    // Fired inside the quiet period: re-armed for the rest of it.
+    tick();
+    ASSERT_EQ(timers.size(), 1U);
+    EXPECT_LE(delays.back(), 50U);
+    EXPECT_TRUE(ran.empty());
+    std::this_thread::sleep_for(60ms);
+    tick();
+    EXPECT_EQ(ran, std::vector<int>{3});
+    EXPECT_EQ(debounce.dropped(), 2U);
+    debounce.push(4);
+  }
+  // The stage is gone before its timer fires.
+  tick();
+  EXPECT_EQ(ran, std::vector<int>{3});
+  EXPECT_EQ(chains, 1);
+
+  // An inline scheduler cannot wait out a long quiet period, so each event
+  // runs at once instead of re-arming until it ends.
+  {
+    Debounce<int> instant(
+        1h, start,
+        [](const std::function<void()>& task, std::size_t) { task(); });
+    instant.push(5);
+    instant.push(6);
+    EXPECT_EQ(ran, (std::vector<int>{3, 5, 6}));
+    EXPECT_EQ(instant.dropped(), 0U);
+  }
+
+  ran.clear();
+  delays.clear();
+  Throttle<int> throttle(100ms, start, manual);
+  throttle.push(1);
+  throttle.push(2);
+  throttle.push(3);
+  EXPECT_EQ(ran, std::vector<int>{1});
+  tick();
+  EXPECT_EQ(ran, (std::vector<int>{1, 3}));
+  tick();
+  EXPECT_TRUE(timers.empty());
+  throttle.push(4);
+  EXPECT_EQ(ran, (std::vector<int>{1, 3, 4}));
+  EXPECT_EQ(throttle.dropped(), 1U);
+  EXPECT_EQ(delays, (std::vector<std::size_t>{100, 100, 100}));
+  EXPECT_EQ(chains, 6);
+}
+
+TEST(PoolTest, AcquireWaitsForReturnedObjectsWithoutBlocking) {
+  using MyResult = Result<int, std::string>;
+  struct Connection {
+    int id;
+    int queries = 0;
+  };
+  int connected = 0;
+  AsyncPool<Connection> pool(
+      [&connected] {
+        return std::make_unique<Connection>(Connection{++connected});
+      },
+      2, 1);
+
+  // The step parks its continuation, as one waiting on the server would.
+  std::vector<std::function<void(MyResult)>> parked;
+  std::vector<int> used;
+  auto query = pool.with([&](Connection& db, auto next, MyResult input) {
+    ++db.queries;
+    used.push_back(db.id);
+    parked.emplace_back([next, value = *input.value](MyResult) mutable {
+      next(MyResult::Ok(value + 1));
+    });
+  });
+  std::vector<int> results;
+  auto run = [&] {
+    initAsyncChain<int, std::string>().then(query).finally(
+        [&results](MyResult result) { results.push_back(*result.value); });
+  };
+  run();
+  run();
+  run();
+  EXPECT_EQ(pool.size(), 2U);
+  EXPECT_EQ(pool.leased(), 2U);
+  EXPECT_EQ(pool.waiting(), 1U);
+  EXPECT_EQ(used, (std::vector<int>{1, 2}));
+
+  // Continuing the first chain returns its connection to the third.
+  parked[0](MyResult::Ok(0));
+  EXPECT_EQ(results, std::vector<int>{1});
+  EXPECT_EQ(pool.waiting(), 0U);
+  EXPECT_EQ(used, (std::vector<int>{1, 2, 1}));
+
+  // A chain dropped without continuing returns its connection too.
+  parked[1] = nullptr;
+  EXPECT_EQ(pool.leased(), 1U);
+  parked[2](MyResult::Ok(0));
+  EXPECT_EQ(pool.leased(), 0U);
+
+  // Returned objects are reused from the thread cache, then shared ones.
+  run();
+  run();
+  EXPECT_EQ(connected, 2);
+  parked.clear();
+  EXPECT_EQ(pool.leased(), 0U);
+
+  // Threads contending for two objects: every acquire is served.
+  std::atomic<int> served{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&pool, &served] {
+      for (int i = 0; i < 2000; ++i) {
+        pool.acquire([&served](AsyncPool<Connection>::Lease lease) {
+          ++lease->queries;
+          ++served;
+        });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(served.load(), 8000);
+  EXPECT_EQ(pool.leased(), 0U);
+  EXPECT_EQ(pool.waiting(), 0U);
+  EXPECT_EQ(connected, 2);
+
+  // Returning the only object to a long queue serves the waiters one after
+  // another rather than each inside the previous one's release.
+  AsyncPool<Connection> single(
+      [] { return std::make_unique<Connection>(Connection{0}); }, 1);
+  AsyncPool<Connection>::Lease held;
+  single.acquire(
+      [&held](AsyncPool<Connection>::Lease lease) { held = std::move(lease); });
+  int queued = 0;
+  for (int i = 0; i < 100000; ++i) {
+    single.acquire([&queued](AsyncPool<Connection>::Lease) { ++queued; });
+  }
+  EXPECT_EQ(single.waiting(), 100000U);
+  held.reset();
+  EXPECT_EQ(queued, 100000);
+  EXPECT_EQ(single.waiting(), 0U);
+  EXPECT_EQ(single.leased(), 0U);
+
+  // A pool made after another is destroyed may take over its per-thread
+  // entries, but not the objects cached in them.
+  {
+    AsyncPool<Connection> gone(
+        [] { return std::make_unique<Connection>(Connection{-1}); }, 1);
+    gone.acquire([](AsyncPool<Connection>::Lease) {});
+  }
+  AsyncPool<Connection> fresh(
+      [] { return std::make_unique<Connection>(Connection{3}); }, 1);
+  int fresh_id = 0;
+  fresh.acquire([&fresh_id](AsyncPool<Connection>::Lease lease) {
+    fresh_id = lease->id;
+  });
+  EXPECT_EQ(fresh_id, 3);
+
+  // A failed create gives its capacity back.
+  int attempts = 0;
+  AsyncPool<Connection> flaky(
+      [&attempts]() -> std::unique_ptr<Connection> {
+        if (++attempts == 1) {
+          throw std::runtime_error("refused");
+        }
+        return attempts == 2 ? nullptr
+                             : std::make_unique<Connection>(Connection{4});
+      },
+      1);
+  auto acquire_flaky = [&flaky, &fresh_id] {
+    flaky.acquire([&fresh_id](AsyncPool<Connection>::Lease lease) {
+      fresh_id = lease->id;
+    });
+  };
+  EXPECT_THROW(acquire_flaky(), std::runtime_error);
+  EXPECT_THROW(acquire_flaky(), std::logic_error);
+  acquire_flaky();
+  EXPECT_EQ(fresh_id, 4);
+  EXPECT_EQ(flaky.size(), 1U);
+
+  // Callbacks still queued do not keep a dropped pool alive.
+  auto sentinel = std::make_shared<int>(0);
+  std::weak_ptr<int> watched = sentinel;
+  {
+    AsyncPool<Connection> empty(
+        [] { return std::make_unique<Connection>(Connection{0}); }, 0);
+    empty.acquire([sentinel](AsyncPool<Connection>::Lease) {});
+    EXPECT_EQ(empty.waiting(), 1U);
+  }
+  sentinel.reset();
+  EXPECT_TRUE(watched.expired());
+}
+
+TEST(DagTest, LaunchesNodesWhenInputsCompleteAndPropagatesErrors) {
+  using MyResult = Result<int, std::string>;
+  // B and C depend on A, D on B and C, E on A only. B and C park their
+  // continuations so the test decides when each completes.
+  std::vector<std::string> ran;
+  std::function<void(MyResult)> finish_b;
+  std::function<void(MyResult)> finish_c;
+  auto a = [&ran](auto next, std::vector<MyResult> in) {
+    ran.push_back("A");
+    next(MyResult::Ok(*in[0].value + 1));
+  };
+  auto b = [&](auto next, std::vector<MyResult>) {
+    ran.push_back("B");
+    finish_b = std::move(next);
+  };
+  auto c = [&](auto next, std::vector<MyResult>) {
+    ran.push_back("C");
+    finish_c = std::move(next);
+  };
+  auto d = [&ran](auto next, std::vector<MyResult> in) {
+    ran.push_back("D");
+    next(MyResult::Ok(*in[0].value * *in[1].value));
+  };
+  auto e = [&ran](auto next, std::vector<MyResult> in) {
+    ran.push_back("E");
+    next(MyResult::Ok(-*in[0].value));
+  };
+
+  Dag<int> dag;
+  const auto node_a = dag.node(a);
+  const auto node_b = dag.node(b, {node_a});
+  const auto node_c = dag.node(c, {node_a});
+  const auto node_d = dag.node(d, {node_b, node_c});
+  dag.node(e, {node_a});
+  dag.setOutput(node_d);
+  EXPECT_EQ(dag.depth(), 3U);
+  EXPECT_THROW(dag.node(a, {42}), std::invalid_argument);
+
+  std::optional<MyResult> out;
+  auto start = [](auto next, MyResult) { next(MyResult::Ok(1)); };
+  initAsyncChain<int, std::string>().then(start).then(dag).finally(
+      [&out](MyResult result) { out = result; });
+  // A ran and released B, C and E at once; D waits for both B and C.
+  EXPECT_EQ(ran, (std::vector<std::string>{"A", "B", "C", "E"}));
+  finish_c(MyResult::Ok(5));
+  EXPECT_FALSE(out.has_value());
+  finish_b(MyResult::Ok(3));
+  ASSERT_TRUE(out.has_value());
+  EXPECT_EQ(*out->value, 15);
+  EXPECT_EQ(ran.back(), "D");
+
+  // A failed input skips D, and its error becomes D's result.
+  ran.clear();
+  std::vector<MyResult> results;
+  dag.run(MyResult::Ok(1), [&results](std::vector<MyResult> all) {
+    results = std::move(all);
+  });
+  finish_b(MyResult::Err("b failed"));
+  finish_c(MyResult::Ok(5));
+  ASSERT_EQ(results.size(), 5U);
+  EXPECT_EQ(*results[node_d].error, "b failed");
+  EXPECT_EQ(*results[4].value, -2);
+  EXPECT_EQ(std::count(ran.begin(), ran.end(), "D"), 0);
+}
+
+TEST(ExecutorTest, DeficitRoundRobinInterleavesTenants) {
+  std::vector<TenantId> order;
+  {
+    Executor executor(1);
+    auto gate = blockWorker(executor);
+    for (int i = 0; i < 6; ++i) {
+      executor.post(1, [&order] { order.push_back(1); });
+    }
+    for (int i = 0; i < 2; ++i) {
+      executor.post(2, [&order] { order.push_back(2); });
+    }
+    gate.set_value();
+  }
+  EXPECT_EQ(order, (std::vector<TenantId>{1, 2, 1, 2, 1, 1, 1, 1}));
+}
+
+TEST(ExecutorTest, TenantWeightSetsQuantum) {
+  std::vector<TenantId> order;
+  {
+    Executor executor(1);
+    executor.setTenantQuota(1, TenantQuota{3});
+    auto gate = blockWorker(executor);
+    for (int i = 0; i < 6; ++i) {
+      executor.post(1, [&order] { order.push_back(1); });
+      executor.post(2, [&order] { order.push_back(2); });
+    }
+    gate.set_value();
+  }
+  EXPECT_EQ(order, (std::vector<TenantId>{1, 1, 1, 2, 1, 1, 1, 2, 2, 2, 2,
+                                          2}));
+}
+
+TEST(ExecutorTest, InFlightQuotaCapsConcurrency) {
+  std::atomic<int> running{0};
+  std::atomic<int> peak{0};
+  Executor executor(4);
+  TenantQuota quota;
+  quota.max_in_flight = 1;
+  executor.setTenantQuota(7, quota);
+  for (int i = 0; i < 8; ++i) {
+    executor.post(7, [&] {
+      const int now = ++running;
+      int seen = peak.load();
+      while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      --running;
+    });
+  }
+  // With the cap in place this runs only after the other eight completed.
+  std::promise<TenantStats> last;
+  executor.post(7, [&] { last.set_value(executor.stats(7)); });
+  const auto stats = last.get_future().get();
+  EXPECT_EQ(peak.load(), 1);
+  EXPECT_EQ(stats.submitted, 9U);
+  EXPECT_EQ(stats.completed, 8U);
+  EXPECT_EQ(stats.in_flight, 1U);
+  EXPECT_EQ(stats.queued, 0U);
+}
+
+TEST(ExecutorTest, RateQuotaSpacesDispatch) {
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<int> ran{0};
+  {
+    Executor executor(2);
+    TenantQuota quota;
+    quota.max_rate_per_sec = 200;
+    executor.setTenantQuota(3, quota);
+    for (int i = 0; i < 5; ++i) {
+      executor.post(3, [&ran] { ++ran; });
+    }
+    // An unthrottled tenant is not held back by tenant 3's quota.
+    std::promise<void> other;
+    executor.post(4, [&other] { other.set_value(); });
+    EXPECT_EQ(other.get_future().wait_for(std::chrono::seconds(1)),
+              std::future_status::ready);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(ran.load(), 5);
+  EXPECT_GE(elapsed, std::chrono::milliseconds(15));
+}
+
+TEST(ExecutorTest, PostBatchRunsEveryTask) {
+  std::atomic<int> ran{0};
+  {
+    Executor executor(4);
+    std::vector<Executor::Task> tasks;
+    for (int i = 0; i < 100; ++i) {
+      tasks.emplace_back([&ran] { ++ran; });
+    }
+    executor.postBatch(5, tasks);
+    EXPECT_TRUE(tasks.empty());
+  }
+  EXPECT_EQ(ran.load(), 100);
+}
+
+TEST(ExecutorTest, SpinningWorkerPicksUpStreamedPosts) {
+  std::atomic<int> ran{0};
+  {
+    ExecutorOptions options;
+    options.threads = 2;
+    options.max_spin = std::chrono::microseconds(200);
+    Executor executor(options);
+    for (int i = 0; i < 500; ++i) {
+      executor.post([&ran] { ++ran; });
+      if (i % 50 == 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+  }
+  EXPECT_EQ(ran.load(), 500);
+}
+
+TEST(ExecutorTest, ParsesKernelCpuLists) {
+  EXPECT_EQ(parseCpuList("0-3,8,10-11\n"),
+            (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_TRUE(parseCpuList("").empty());
+  const auto topology = cpuTopology();
+  ASSERT_FALSE(topology.nodes.empty());
+  EXPECT_GE(topology.cpuCount(), 1U);
+}
+
+TEST(ExecutorTest, PinnedWorkersReportTheirNode) {
+  const auto topology = cpuTopology();
+  std::vector<int> nodes;
+  std::mutex nodes_mutex;
+  {
+    ExecutorOptions options;
+    options.threads = 2;
+    options.pin_workers = true;
+    Executor executor(options);
+    EXPECT_EQ(executor.nodeCount(), topology.nodes.size());
+    for (int i = 0; i < 8; ++i) {
+      executor.post([&] {
+        std::lock_guard<std::mutex> lock(nodes_mutex);
+        nodes.push_back(Executor::currentNode());
+      });
+    }
+  }
+  EXPECT_EQ(Executor::currentNode(), -1);
+  ASSERT_EQ(nodes.size(), 8U);
+  for (int node : nodes) {
+    EXPECT_GE(node, 0);
+    EXPECT_LT(static_cast<std::size_t>(node), topology.nodes.size());
+  }
+}
+
+TEST(TimerTest, SlackCoalescesNearbyDeadlines) {
+  const auto now = std::chrono::steady_clock::now();
+  CoalescingTimerQueue exact;
+  CoalescingTimerQueue coalescing;
+  coalescing.setSlack(1000, 0.05);
+  for (int i = 0; i < 10; ++i) {
+    const auto at = now + std::chrono::milliseconds(i);
+    exact.insert([] {}, 1000, at);
+    coalescing.insert([] {}, 1000, at);
+  }
+  EXPECT_EQ(exact.slotCount(), 10U);
+  EXPECT_LE(coalescing.slotCount(), 2U);
+
+  // Deadlines 1000-1009 ms out move by at most ±50 ms.
+  std::vector<CoalescingTimerQueue::Task> due;
+  EXPECT_EQ(coalescing.expire(now + std::chrono::milliseconds(949), due), 0U);
+  EXPECT_TRUE(due.empty());
+  coalescing.expire(now + std::chrono::milliseconds(1060), due);
+  EXPECT_EQ(due.size(), 10U);
+  EXPECT_EQ(coalescing.size(), 0U);
+}
+
+// Runs the same insert/cancel/expire script against any timer queue.
+template <typename Queue>
+static void checkTimerQueue(Queue& queue) {
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<std::size_t> fired;
+  auto record = [&fired](std::size_t delay) {
+    return [&fired, delay] { fired.push_back(delay); };
+  };
+  queue.insert(record(30), 30, now);
+  auto middle = queue.insert(record(20), 20, now);
+  queue.insert(record(10), 10, now);
+  queue.insert(record(70000), 70000, now);
+  EXPECT_TRUE(queue.cancel(middle));
+  EXPECT_FALSE(queue.cancel(middle));
+  EXPECT_EQ(queue.size(), 3U);
+  EXPECT_GE(queue.bytes(), 3 * sizeof(typename Queue::Task));
+
+  std::vector<typename Queue::Task> due;
+  queue.expire(now + std::chrono::milliseconds(25), due);
+  queue.expire(now + std::chrono::milliseconds(69999), due);
+  for (auto& task : due) {
+    task();
+  }
+  EXPECT_EQ(fired, (std::vector<std::size_t>{10, 30}));
+  due.clear();
+  queue.expire(now + std::chrono::milliseconds(70002), due);
+  ASSERT_EQ(due.size(), 1U);
+  due.front()();
+  EXPECT_EQ(fired.back(), 70000U);
+  EXPECT_EQ(queue.size(), 0U);
+  EXPECT_FALSE(queue.nextExpiry().has_value());
+}
+
+TEST(TimerTest, QueuesInsertCancelAndExpireInOrder) {
+  HeapTimerQueue heap;
+  checkTimerQueue(heap);
+  WheelTimerQueue wheel;
+  checkTimerQueue(wheel);
+  CoalescingTimerQueue coalescing;
+  checkTimerQueue(coalescing);
+}
+
+TEST(TimerTest, WheelSchedulerRunsDelayedRetries) {
+  using MyResult = Result<int, std::string>;
+  BasicTimerScheduler<WheelTimerQueue> timer;
+  setScheduler(timer.scheduler());
+  auto flaky = [](auto next, std::size_t attempt) {
+    next(attempt < 2 ? MyResult::Err("fail") : MyResult::Ok(1));
+  };
+  std::promise<MyResult> done;
+  initAsyncChain<int, std::string>()
+      .thenWithRetryDelayed<3, 3>(flaky)
+      .finally([&done](MyResult result) { done.set_value(result); });
+  auto result = done.get_future().get();
+  setScheduler([](const std::function<void()>& task, std::size_t) { task(); });
+  EXPECT_TRUE(result.is_ok());
+  EXPECT_EQ(timer.stats().fired, 2U);
+}
+
+TEST(TimerTest, DelayedRetryRunsOnTimerThread) {
+  using MyResult = Result<int, std::string>;
+  TimerScheduler timer;
+  setScheduler(timer.scheduler());
+  std::vector<std::size_t> attempts;
+  auto flaky = [&attempts](auto next, std::size_t attempt) {
+    attempts.push_back(attempt);
+    if (attempt < 2) {
+      next(MyResult::Err("fail"));
+    } else {
+      next(MyResult::Ok(7));
+    }
+  };
+  std::promise<MyResult> done;
+  initAsyncChain<int, std::string>()
+      .thenWithRetryDelayed<3, 5>(flaky)
+      .finally([&done](MyResult result) { done.set_value(result); });
+  auto result = done.get_future().get();
+  setScheduler([](const std::function<void()>& task, std::size_t) { task(); });
+  EXPECT_TRUE(result.is_ok());
+  EXPECT_EQ(*result.value, 7);
+  EXPECT_EQ(attempts, (std::vector<std::size_t>{0, 1, 2}));
+  EXPECT_EQ(timer.stats().fired, 2U);
+}
+
+TEST(TimerTest, CoalescedTimersFireAsOneBatch) {
+  std::atomic<int> fired{0};
+  std::promise<void> done;
+  {
+    TimerScheduler timer;
+    timer.setSlack(20, 0.5);
+    for (int i = 0; i < 20; ++i) {
+      timer.schedule(
+          [&] {
+            if (++fired == 20) {
+              done.set_value();
+            }
+          },
+          20);
+    }
+    done.get_future().wait();
+    const auto stats = timer.stats();
+    EXPECT_EQ(stats.fired, 20U);
+    EXPECT_LE(stats.slots_expired, 2U);
+  }
+}
+
+TEST(TimerTest, ExpiredBatchIsPostedToExecutor) {
+  Executor executor(2);
+  TimerScheduler timer;
+  timer.dispatchTo(executor);
+  std::atomic<int> ran{0};
+  std::promise<void> done;
+  std::vector<TimerScheduler::Task> tasks;
+  for (int i = 0; i < 10; ++i) {
+    tasks.emplace_back([&] {
+      if (++ran == 10) {
+        done.set_value();
+      }
+    });
+  }
+  timer.scheduleBatch(tasks, 5);
+  done.get_future().wait();
+  EXPECT_EQ(timer.stats().fired, 10U);
+  EXPECT_EQ(executor.stats(kDefaultTenant).submitted, 10U);
+}
+
+TEST(StepTimingTest, SeparatesCpuFromWaiting) {
+  using MyResult = Result<int, std::string>;
+  auto cpu_ms = [] {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  };
+  auto spin = [&cpu_ms](auto next, MyResult result) {
+    const auto until = cpu_ms() + 5;
+    while (cpu_ms() < until) {
+    }
+    next(result);
+  };
+  std::thread waiter;
+  auto wait = [&waiter](auto next, MyResult result) {
+    waiter = std::thread([next, result]() mutable {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      next(result);
+    });
+  };
+  using Plan = decltype(initAsyncChain<int, std::string>().then(spin).then(
+      wait));
+
+  setStepTiming(true);
+  std::promise<void> done;
+  initAsyncChain<int, std::string>().then(spin).then(wait).finally(
+      [&](MyResult) { done.set_value(); });
+  done.get_future().wait();
+  waiter.join();
+  setStepTiming(false);
+
+  const auto timings = Plan::stepTimings();
+  ASSERT_EQ(timings.steps.size(), 2U);
+  EXPECT_EQ(timings.steps[0].calls, 1U);
+  EXPECT_EQ(timings.steps[1].calls, 1U);
+  EXPECT_GE(timings.steps[0].cpu_ns, 4000000U);
+  EXPECT_GE(timings.steps[1].wall_ns, 10000000U);
+  EXPECT_LT(timings.steps[1].cpu_ns, 2000000U);
+
+  bool listed = false;
+  for (const auto& plan : stepTimings()) {
+    listed = listed || plan.plan == timings.plan;
+  }
+  EXPECT_TRUE(listed);
+}
+
+TEST(StatsTest, PublishesConsistentSnapshotToSegment) {
+  using MyResult = Result<int, std::string>;
+  auto flaky = [](auto next, std::size_t attempt) {
+    next(attempt < 1 ? MyResult::Err("again") : MyResult::Ok(0));
+  };
+  auto fail = [](auto next, MyResult) { next(MyResult::Err("fail")); };
+  const auto before = collectStats();
+  const auto gauge = addStatsGauge("queue_depth", [] { return 7; });
+  const std::string path =
+      "/tmp/async_chain_stats_test." + std::to_string(::getpid());
+  {
+    StatsPublisher publisher(path, std::chrono::milliseconds(1));
+    for (int i = 0; i < 3; ++i) {
+      initAsyncChain<int, std::string>()
+          .thenWithRetry<2>(flaky)
+          .then(fail)
+          .finally([](MyResult) {});
+    }
+  }
+  removeStatsGauge(gauge);
+
+  const auto stats = readStatsSegment(path);
+  ::unlink(path.c_str());
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_EQ(stats->chains_started - before.chains_started, 3U);
+  EXPECT_EQ(stats->chains_failed - before.chains_failed, 3U);
+  EXPECT_EQ(stats->retries[1] - before.retries[1], 3U);
+  using Plan = decltype(initAsyncChain<int, std::string>()
+                            .thenWithRetry<2>(flaky)
+                            .then(fail));
+  const auto row = stats->stepRow(Plan::statsPlan(), 1);
+  std::uint64_t second_step = 0;
+  for (std::size_t b = 0; b < kStatsLatencyBuckets; ++b) {
+    second_step += stats->step_latency[row][b] - before.step_latency[row][b];
+  }
+  EXPECT_EQ(second_step, 3U);
+  const auto* end = stats->error_codes + stats->error_code_count;
+  const auto* failed = std::find_if(
+      stats->error_codes, end,
+      [](const auto& e) { return e.code == statsErrorCode("fail"); });
+  ASSERT_NE(failed, end);
+  EXPECT_GE(failed->count, 3U);
+  ASSERT_EQ(stats->gauge_count, 1U);
+  EXPECT_STREQ(stats->gauges[0].name, "queue_depth");
+  EXPECT_EQ(stats->gauges[0].value, 7U);
+}
+
+TEST(StatsTest, TracksFrameBytesOfChainsInFlight) {
+  using MyResult = Result<int, int>;
+  std::function<void(MyResult)> parked;
+  auto park = [&parked](auto next, MyResult) { parked = std::move(next); };
+  auto add = [](auto next, MyResult r) { next(MyResult::Ok(*r.value + 1)); };
+  int out = 0;
+  auto done = [&out](MyResult r) { out = *r.value; };
+  using Plan =
+      decltype(initAsyncChain<int, int>().then(park).then(add).then(add));
+  static_assert(Plan::kFrameBytes == 3 * sizeof(void*));
+  constexpr auto frame = Plan::frameBytes<decltype(done)>();
+  static_assert(frame == Plan::kFrameBytes + sizeof(done));
+
+  const auto before = collectStats().live_frame_bytes;
+  initAsyncChain<int, int>().then(park).then(add).then(add).finally(done);
+  const auto parked_stats = collectStats();
+  EXPECT_EQ(parked_stats.live_frame_bytes, before + frame);
+  EXPECT_GE(parked_stats.peak_live_frame_bytes, before + frame);
+
+  parked(MyResult::Ok(1));
+  EXPECT_EQ(out, 3);
+  EXPECT_EQ(collectStats().live_frame_bytes, before);
+}
+
+TEST(StatsTest, ExportsPrometheusTextToFileAndSocket) {
+  using MyResult = Result<int, int>;
+  auto fail = [](auto next, MyResult) { next(MyResult::Err(503)); };
+  using Plan = decltype(initAsyncChain<int, int>().then(fail));
+  nameStatsPlan(Plan::statsPlan(), "checkout");
+  initAsyncChain<int, int>().then(fail).finally([](MyResult) {});
+
+  const auto text = renderPrometheus(collectStats());
+  EXPECT_NE(text.find("async_chain_errors_total{code=\"503\"} 1"),
+            std::string::npos);
+  EXPECT_NE(text.find("async_chain_plan_failures_total{plan=\"checkout\"} 1"),
+            std::string::npos);
+  EXPECT_NE(text.find("async_chain_plan_duration_seconds_count{plan="
+                      "\"checkout\"} 1"),
+            std::string::npos);
+  EXPECT_NE(text.find("async_chain_step_duration_seconds_count{plan="
+                      "\"checkout\",step=\"0\"} 1"),
+            std::string::npos);
+
+  const auto base = "/tmp/async_chain_prom." + std::to_string(::getpid());
+  {
+    PrometheusExporter exporter(PrometheusOutput::kFile, base + ".prom");
+  }
+  std::ifstream file(base + ".prom");
+  const std::string written((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+  ::unlink((base + ".prom").c_str());
+  EXPECT_NE(written.find("async_chain_plan_failures_total{plan=\"checkout\"}"),
+            std::string::npos);
+
+  PrometheusExporter exporter(PrometheusOutput::kUnixSocket, base + ".sock");
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, (base + ".sock").c_str());
+  ASSERT_EQ(::connect(fd, reinterpret_cast<sockaddr*>(&address),
+                      sizeof(address)),
+            0);
+  const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+  ASSERT_EQ(::send(fd, request.data(), request.size(), 0),
+            static_cast<ssize_t>(request.size()));
+  std::string response;
+  char buffer[4096];
+  for (ssize_t n; (n = ::recv(fd, buffer, sizeof(buffer), 0)) > 0;) {
+    response.append(buffer, static_cast<std::size_t>(n));
+  }
+  ::close(fd);
+  EXPECT_EQ(response.rfind("HTTP/1.0 200 OK", 0), 0U);
+  EXPECT_NE(response.find("async_chain_errors_total{code=\"503\"}"),
+            std::string::npos);
+}
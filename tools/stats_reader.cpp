@@ -0,0 +1,98 @@
+// Prints a snapshot of a StatsPublisher segment without touching the
+// publishing process.
+//
+//   async_chain_stats <path> [--watch=ms]
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "bench/bench_util.hpp"
+#include "include/stats.hpp"
+
+using namespace async_chain;
+
+namespace {
+
+void print(const StatsData& stats) {
+  const auto now_ns = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  std::printf("published   %.1f ms ago\n",
+              static_cast<double>(now_ns - stats.published_unix_ns) / 1e6);
+  std::printf("chains      %llu started, %llu completed, %llu failed, "
+              "%llu in flight\n",
+              static_cast<unsigned long long>(stats.chains_started),
+              static_cast<unsigned long long>(stats.chains_completed),
+              static_cast<unsigned long long>(stats.chains_failed),
+              static_cast<unsigned long long>(stats.inFlight()));
+  std::printf("frames      %llu bytes live, %llu peak\n",
+              static_cast<unsigned long long>(stats.live_frame_bytes),
+              static_cast<unsigned long long>(stats.peak_live_frame_bytes));
+  std::printf("retries    ");
+  for (std::size_t a = 1; a < kStatsMaxAttempts; ++a) {
+    if (stats.retries[a] != 0) {
+      std::printf(" attempt %zu: %llu", a,
+                  static_cast<unsigned long long>(stats.retries[a]));
+    }
+  }
+  std::printf("\n");
+  std::printf("speculation %llu committed, %llu rerun, %llu discarded\n",
+              static_cast<unsigned long long>(stats.speculations[0]),
+              static_cast<unsigned long long>(stats.speculations[1]),
+              static_cast<unsigned long long>(stats.speculations[2]));
+  std::printf("plan                 step        count      p50 us      "
+              "p99 us\n");
+  const auto print_row = [&stats](const char* plan, const std::string& step,
+                                  std::size_t row) {
+    std::uint64_t count = 0;
+    for (auto n : stats.step_latency[row]) {
+      count += n;
+    }
+    if (count == 0) {
+      return;
+    }
+    std::printf("%-20s %4s  %11llu  %10.1f  %10.1f\n", plan, step.c_str(),
+                static_cast<unsigned long long>(count),
+                static_cast<double>(stats.stepQuantile(row, 0.5)) / 1e3,
+                static_cast<double>(stats.stepQuantile(row, 0.99)) / 1e3);
+  };
+  for (std::size_t p = 0; p < stats.plan_count; ++p) {
+    for (std::size_t s = 0; s < stats.plan_step_rows[p]; ++s) {
+      print_row(stats.plan_names[p], std::to_string(s), stats.stepRow(p, s));
+    }
+  }
+  print_row("other", "-", kStatsMaxStepRows - 1);
+  for (std::size_t g = 0; g < stats.gauge_count; ++g) {
+    std::printf("gauge       %s = %llu\n", stats.gauges[g].name,
+                static_cast<unsigned long long>(stats.gauges[g].value));
+  }
+}
+
+}  // namespace
+
+auto main(int argc, char** argv) -> int {
+  if (argc < 2 || std::string(argv[1]).rfind("--", 0) == 0) {
+    std::fprintf(stderr, "usage: async_chain_stats <path> [--watch=ms]\n");
+    return 2;
+  }
+  const bench::Flags flags(argc, argv);
+  const auto watch_ms = static_cast<std::int64_t>(flags.get("watch", 0));
+  for (;;) {
+    const auto stats = readStatsSegment(argv[1]);
+    if (!stats) {
+      std::fprintf(stderr, "%s is not a stats segment\n", argv[1]);
+      return 1;
+    }
+    print(*stats);
+    if (watch_ms <= 0) {
+      return 0;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(watch_ms));
+    std::printf("\n");
+  }
+}